@@ -17,7 +17,12 @@ static void zero_waveforms(xm_context_t* ctx) {
 	uint32_t sample_length;
 	for(uint16_t s = 0; s < xm_get_number_of_samples(ctx); ++s) {
 		sample_data = xm_get_sample_waveform(ctx, s, &sample_length);
-		if(sample_data == NULL) continue;
+		if(sample_data == NULL) {
+			/* Built with XM_ADPCM_SAMPLES */
+			fprintf(stderr, "sample waveforms cannot be zeroed "
+			        "in this build\n");
+			exit(1);
+		}
 		memset(sample_data, 0,
 		       sample_length * sizeof(xm_sample_point_t));
 	}
@@ -115,13 +120,15 @@ int main(int argc, char** argv) {
 		}
 		exit(0);
 	} else if(!strcmp("dump", action)) {
-		char* dump = malloc(xm_dump_size(ctx));
+		/* May be smaller than ctx_size, eg with XM_PACKED_PATTERNS */
+		uint32_t dump_size = xm_dump_size(ctx);
+		char* dump = malloc(dump_size);
 		if(dump == NULL) {
 			perror("malloc");
 			exit(1);
 		}
 		xm_dump_context(ctx, dump);
-		if(!fwrite(dump, ctx_size, 1, stdout)) {
+		if(!fwrite(dump, dump_size, 1, stdout)) {
 			perror("fwrite");
 			exit(1);
 		}
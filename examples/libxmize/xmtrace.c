@@ -0,0 +1,140 @@
+/* Author: Romain "Artefact2" Dal Maso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Decodes trace records, either read raw from stdin (as written by an
+   application doing fwrite() on what xm_drain_trace() returned), or
+   recorded while playing a module once. libxm must be built with
+   -DXM_TRACE=ON for the latter. */
+
+#include <xm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE 48000
+#define CHUNK_FRAMES 256
+#define MAX_RECORDS 256
+
+static const char* event_names[] = {
+	[XM_TRACE_ROW] = "row",
+	[XM_TRACE_JUMP] = "jump",
+	[XM_TRACE_LOOP] = "loop",
+	[XM_TRACE_NOTE] = "note",
+	[XM_TRACE_SPEED] = "speed",
+	[XM_TRACE_SEEK] = "seek",
+};
+
+static void print_record(const xm_trace_record_t* r) {
+	printf("%10u %3u:%02X.%02u ", r->samples, r->pattern_index, r->row,
+	       r->tick);
+	if(r->event >= sizeof(event_names) / sizeof(event_names[0])) {
+		printf("?%u %u %u %u\n", r->event, r->args[0], r->args[1],
+		       r->args[2]);
+		return;
+	}
+
+	printf("%-5s", event_names[r->event]);
+	switch(r->event) {
+	case XM_TRACE_ROW:
+		printf(" pattern %u\n", r->args[0]);
+		break;
+	case XM_TRACE_JUMP:
+		printf(" to %u:%02X\n", r->args[0], r->args[1]);
+		break;
+	case XM_TRACE_LOOP:
+		printf(" count %u\n", r->args[0]);
+		break;
+	case XM_TRACE_NOTE:
+		printf(" ch %u note %u instrument %u sample %u\n", r->channel,
+		       r->args[0], r->args[1], r->args[2]);
+		break;
+	case XM_TRACE_SPEED:
+		printf(" tempo %u bpm %u\n", r->args[0], r->args[1]);
+		break;
+	case XM_TRACE_SEEK:
+		printf(" to %u:%02X.%02u\n", r->args[0], r->args[1],
+		       r->args[2]);
+		break;
+	}
+}
+
+static void decode_stdin(void) {
+	xm_trace_record_t r;
+	while(fread(&r, sizeof(r), 1, stdin) == 1) {
+		print_record(&r);
+	}
+}
+
+static char* read_stdin(uint32_t* length) {
+	size_t cap = 1 << 16, len = 0, r;
+	char* data = malloc(cap);
+	while(data && (r = fread(data + len, 1, cap - len, stdin)) > 0) {
+		len += r;
+		if(len == cap) data = realloc(data, cap *= 2);
+	}
+	if(data == NULL || len > UINT32_MAX) {
+		fprintf(stderr, "could not read module\n");
+		exit(1);
+	}
+	*length = (uint32_t)len;
+	return data;
+}
+
+static void play_stdin(void) {
+	uint32_t length;
+	char* moddata = read_stdin(&length);
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module(moddata, length, p)) {
+		fprintf(stderr, "xm_prescan_module() failed\n");
+		exit(1);
+	}
+	xm_context_t* ctx = xm_create_context(malloc(xm_size_for_context(p)),
+	                                      p, moddata, length);
+	xm_set_sample_rate(ctx, RATE);
+
+	static _Alignas(max_align_t) char pool[1 << 16];
+	static xm_trace_record_t records[MAX_RECORDS];
+	static float frames[2 * CHUNK_FRAMES];
+	xm_trace_t* trace = xm_create_trace(pool, sizeof(pool));
+	xm_set_trace(ctx, trace);
+
+	uint64_t total = 0;
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, CHUNK_FRAMES);
+		uint32_t n;
+		while((n = xm_drain_trace(trace, records, MAX_RECORDS))) {
+			for(uint32_t i = 0; i < n; ++i) print_record(records + i);
+			total += n;
+		}
+	}
+
+	if(total == 0) {
+		fprintf(stderr, "no records, was libxm built with "
+		        "-DXM_TRACE=ON?\n");
+		exit(1);
+	}
+	if(xm_get_trace_drops(trace)) {
+		fprintf(stderr, "%u records dropped\n",
+		        xm_get_trace_drops(trace));
+	}
+}
+
+int main(int argc, char** argv) {
+	if(argc != 2 || (strcmp(argv[1], "play") && strcmp(argv[1], "decode"))) {
+		fprintf(stderr, "Usage: %s play < in.xm\n"
+		        "       %s decode < records.bin\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if(strcmp(argv[1], "play") == 0) {
+		play_stdin();
+	} else {
+		decode_stdin();
+	}
+	return 0;
+}
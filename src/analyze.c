@@ -121,7 +121,7 @@ static void analyze_note_trigger(xm_context_t* ctx, xm_channel_context_t* ch,
 	#endif
 }
 
-void xm_analyze(xm_context_t* restrict ctx, char* restrict out) {
+void xm_analyze_module(xm_context_t* ctx, xm_analysis_t* out) {
 	#if XM_DISABLED_FEATURES > 0 || XM_DISABLED_EFFECTS > 0 \
 		|| XM_LOOPING_TYPE != 2
 	NOTICE("suggested flags will be inaccurate; recompile libxm with"
@@ -138,7 +138,6 @@ void xm_analyze(xm_context_t* restrict ctx, char* restrict out) {
 		: ((uint64_t)1 << FEATURE_LINEAR_FREQUENCIES);
 	uint64_t used_effects = 0;
 	uint16_t used_volume_effects = 0;
-	uint16_t off = 0;
 	int16_t pannings[4] = { -1, -1, -1, -1 };
 	uint8_t panning_type = 0;
 	int16_t tempo = -1;
@@ -386,14 +385,27 @@ void xm_analyze(xm_context_t* restrict ctx, char* restrict out) {
 	used_features |= (uint64_t)((~NUM_CHANNELS(&ctx->module)) & 255)
 		<< FEATURE_VARIABLE_CHANNEL_COUNT;
 
+	*out = (xm_analysis_t){
+		.disabled_effects = ~used_effects,
+		.disabled_features = ~used_features,
+		.disabled_volume_effects = (uint16_t)(~used_volume_effects),
+		.panning_type = panning_type,
+	};
+}
+
+void xm_analyze(xm_context_t* restrict ctx, char* restrict out) {
+	xm_analysis_t a;
+	uint16_t off = 0;
+	xm_analyze_module(ctx, &a);
+
 	append_str(out, &off, " -DXM_DISABLED_EFFECTS=0x");
-	append_u64(out, &off, (uint64_t)(~used_effects));
+	append_u64(out, &off, a.disabled_effects);
 	append_str(out, &off, " -DXM_DISABLED_VOLUME_EFFECTS=0x");
-	append_u16(out, &off, (uint16_t)(~used_volume_effects));
+	append_u16(out, &off, a.disabled_volume_effects);
 	append_str(out, &off, " -DXM_DISABLED_FEATURES=0x");
-	append_u64(out, &off, (uint64_t)(~used_features));
+	append_u64(out, &off, a.disabled_features);
 	append_str(out, &off, " -DXM_PANNING_TYPE=");
-	append_char(out, &off, (char)('0' + panning_type));
+	append_char(out, &off, (char)('0' + a.panning_type));
 
 	if(off < XM_ANALYZE_OUTPUT_SIZE) {
 		out[off] = '\0';
@@ -0,0 +1,175 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+
+/* Cached contexts are stored back to back after the cache header, sorted by
+   offset, each one followed by a copy of its module data (to tell modules
+   with the same hash apart) and padded to CACHE_ALIGNMENT. */
+#define CACHE_ENTRIES 64
+#define CACHE_ALIGNMENT ((uint32_t)alignof(max_align_t))
+#define CACHE_ALIGN_UP(x) (((x) + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1))
+#define CACHE_HEADER_SIZE CACHE_ALIGN_UP((uint32_t)sizeof(xm_cache_t))
+
+struct xm_cache_entry_s {
+	uint64_t hash; /* of the build configuration and module data */
+	uint64_t last_used;
+	uint32_t moddata_length;
+	uint32_t offset; /* of the context, from the start of the cache */
+	uint32_t context_size; /* xm_dump_size() of the context, aligned up */
+	uint32_t size; /* context_size plus the module data, aligned up */
+};
+typedef struct xm_cache_entry_s xm_cache_entry_t;
+
+struct xm_cache_s {
+	xm_cache_entry_t entries[CACHE_ENTRIES]; /* sorted by offset */
+	uint64_t clock;
+	uint32_t pool_size; /* aligned down */
+	uint32_t used; /* end of the last context */
+	uint8_t num_entries;
+	char __pad[7];
+};
+
+/* ----- Static functions ----- */
+
+static uint64_t xm_cache_key(const char*, uint32_t);
+static void xm_cache_evict(xm_cache_t*, uint8_t) __attribute__((nonnull));
+
+/* ----- Function definitions ----- */
+
+static uint64_t xm_cache_key(const char* moddata, uint32_t moddata_length) {
+	/* Anything that changes what xm_create_context() makes of the same
+	   module data */
+	static const uint64_t config[] = {
+		XM_RAMPING,
+		XM_LIBXM_DELTA_SAMPLES,
+		XM_ADPCM_SAMPLES,
+		XM_PACKED_PATTERNS,
+		XM_DEDUPLICATE,
+		XM_STRINGS,
+		XM_TIMING_FUNCTIONS,
+		XM_MUTING_FUNCTIONS,
+		XM_SAMPLE_RATE,
+		XM_MICROSTEP_BITS,
+		XM_PANNING_TYPE,
+		XM_LOOPING_TYPE,
+		XM_DISABLED_EFFECTS,
+		XM_DISABLED_VOLUME_EFFECTS,
+		XM_DISABLED_FEATURES,
+		sizeof(xm_sample_point_t),
+		sizeof(xm_context_t),
+		sizeof(xm_channel_context_t),
+	};
+
+	return xm_fnv1a(xm_fnv1a(FNV1A_BASIS, (const unsigned char*)config,
+	                         sizeof(config)),
+	                (const unsigned char*)moddata, moddata_length);
+}
+
+/* Remove an entry, and move the contexts after it to fill the gap */
+static void xm_cache_evict(xm_cache_t* cache, uint8_t index) {
+	assert(index < cache->num_entries);
+	uint32_t gap = cache->entries[index].size;
+
+	for(uint8_t i = (uint8_t)(index + 1); i < cache->num_entries; ++i) {
+		xm_cache_entry_t* e = cache->entries + i;
+		char* old = (char*)cache + e->offset;
+		e->offset -= gap;
+		__builtin_memmove((char*)cache + e->offset, old, e->size);
+		xm_rebase_context((xm_context_t*)((char*)cache + e->offset),
+		                  (xm_context_t*)old);
+	}
+
+	__builtin_memmove(cache->entries + index, cache->entries + index + 1,
+	                  sizeof(xm_cache_entry_t)
+	                  * (cache->num_entries - index - 1u));
+	cache->num_entries--;
+	cache->used -= gap;
+}
+
+xm_cache_t* xm_create_cache(char* pool, uint32_t pool_size) {
+	if(pool_size < CACHE_HEADER_SIZE) {
+		return nullptr;
+	}
+
+	xm_cache_t* cache = (xm_cache_t*)pool;
+	*cache = (xm_cache_t){
+		.pool_size = pool_size & ~(CACHE_ALIGNMENT - 1),
+		.used = CACHE_HEADER_SIZE,
+	};
+	return cache;
+}
+
+const xm_context_t* xm_cache_lookup(xm_cache_t* restrict cache,
+                                    const char* restrict moddata,
+                                    uint32_t moddata_length) {
+	uint64_t hash = xm_cache_key(moddata, moddata_length);
+	cache->clock++;
+
+	for(uint8_t i = 0; i < cache->num_entries; ++i) {
+		xm_cache_entry_t* e = cache->entries + i;
+		if(e->hash == hash && e->moddata_length == moddata_length
+		   && __builtin_memcmp((char*)cache + e->offset
+		                       + e->context_size,
+		                       moddata, moddata_length) == 0) {
+			e->last_used = cache->clock;
+			return (xm_context_t*)((char*)cache + e->offset);
+		}
+	}
+
+	xm_prescan_data_t p;
+	if(!xm_prescan_module(moddata, moddata_length, &p)) {
+		return nullptr;
+	}
+	/* The context, then a copy of the module data */
+	uint64_t ctx_size = (uint64_t)CACHE_ALIGN_UP(xm_size_for_context(&p))
+		+ moddata_length + CACHE_ALIGNMENT - 1;
+	if(ctx_size > cache->pool_size - CACHE_HEADER_SIZE) {
+		NOTICE("module too large for cache (%llu > %u bytes)",
+		       (unsigned long long)ctx_size,
+		       cache->pool_size - CACHE_HEADER_SIZE);
+		return nullptr;
+	}
+
+	while(cache->num_entries == CACHE_ENTRIES
+	      || cache->pool_size - cache->used < ctx_size) {
+		uint8_t lru = 0;
+		for(uint8_t i = 1; i < cache->num_entries; ++i) {
+			if(cache->entries[i].last_used
+			   < cache->entries[lru].last_used) {
+				lru = i;
+			}
+		}
+		xm_cache_evict(cache, lru);
+	}
+
+	xm_context_t* ctx = xm_create_context((char*)cache + cache->used, &p,
+	                                      moddata, moddata_length);
+	/* Only keep what the context actually uses, which can be less than
+	   xm_size_for_context() */
+	uint32_t dump_size = CACHE_ALIGN_UP(xm_dump_size(ctx));
+	__builtin_memcpy((char*)ctx + dump_size, moddata, moddata_length);
+	cache->entries[cache->num_entries++] = (xm_cache_entry_t){
+		.hash = hash,
+		.last_used = cache->clock,
+		.moddata_length = moddata_length,
+		.offset = cache->used,
+		.context_size = dump_size,
+		.size = dump_size + CACHE_ALIGN_UP(moddata_length),
+	};
+	cache->used += cache->entries[cache->num_entries - 1].size;
+	return ctx;
+}
+
+xm_context_t* xm_copy_context(char* restrict pool,
+                              const xm_context_t* restrict ctx) {
+	__builtin_memcpy(pool, ctx, xm_dump_size(ctx));
+	xm_context_t* copy = (xm_context_t*)pool;
+	xm_rebase_context(copy, ctx);
+	return copy;
+}
@@ -0,0 +1,158 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+
+enum xm_command_type_e {
+	COMMAND_SEEK, /* args: pot, row, tick */
+	COMMAND_MUTE_CHANNEL, /* args: channel, mute */
+	COMMAND_MUTE_INSTRUMENT, /* args: instrument, mute */
+	COMMAND_MAX_LOOP_COUNT, /* args: loop count */
+	COMMAND_SAMPLE_RATE, /* value: rate */
+	COMMAND_TEMPO_SCALE, /* value: scale */
+	COMMAND_TRANSPOSE, /* args: semitones, cents */
+};
+
+struct xm_command_s {
+	uint16_t value;
+	uint8_t type;
+	uint8_t args[3];
+};
+typedef struct xm_command_s xm_command_t;
+
+/* Single producer (the thread calling xm_queue_*()), single consumer (the
+   thread playing the context) */
+struct xm_command_queue_s {
+	xm_ring_t ring;
+	xm_command_t commands[];
+};
+
+static bool xm_queue_command(xm_command_queue_t*, xm_command_t)
+	__attribute__((nonnull));
+
+/* ----- Function definitions ----- */
+
+xm_command_queue_t* xm_create_command_queue(char* pool, uint32_t pool_size) {
+	if(pool_size < sizeof(xm_command_queue_t) + sizeof(xm_command_t)) {
+		return nullptr;
+	}
+
+	xm_command_queue_t* queue = (xm_command_queue_t*)pool;
+	xm_ring_init(&queue->ring,
+	             (pool_size - (uint32_t)sizeof(xm_command_queue_t))
+	             / (uint32_t)sizeof(xm_command_t));
+	return queue;
+}
+
+void xm_set_command_queue([[maybe_unused]] xm_context_t* restrict ctx,
+                          [[maybe_unused]] xm_command_queue_t* restrict
+                          queue) {
+	#if XM_COMMAND_QUEUE
+	ctx->module.commands = queue;
+	#endif
+}
+
+static bool xm_queue_command(xm_command_queue_t* queue, xm_command_t cmd) {
+	uint32_t index;
+	if(!xm_ring_acquire_write(&queue->ring, &index)) {
+		return false;
+	}
+
+	queue->commands[index] = cmd;
+	xm_ring_release_write(&queue->ring);
+	return true;
+}
+
+bool xm_queue_seek(xm_command_queue_t* queue, uint8_t pot, uint8_t row,
+                   uint8_t tick) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_SEEK,
+			.args = { pot, row, tick },
+		});
+}
+
+bool xm_queue_mute_channel(xm_command_queue_t* queue, uint8_t channel,
+                           bool mute) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_MUTE_CHANNEL,
+			.args = { channel, mute },
+		});
+}
+
+bool xm_queue_mute_instrument(xm_command_queue_t* queue, uint8_t instr,
+                              bool mute) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_MUTE_INSTRUMENT,
+			.args = { instr, mute },
+		});
+}
+
+bool xm_queue_max_loop_count(xm_command_queue_t* queue, uint8_t loopcnt) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_MAX_LOOP_COUNT,
+			.args = { loopcnt },
+		});
+}
+
+bool xm_queue_sample_rate(xm_command_queue_t* queue, uint16_t rate) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_SAMPLE_RATE,
+			.value = rate,
+		});
+}
+
+bool xm_queue_tempo_scale(xm_command_queue_t* queue, uint16_t scale) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_TEMPO_SCALE,
+			.value = scale,
+		});
+}
+
+bool xm_queue_transpose(xm_command_queue_t* queue, int8_t semitones,
+                        int8_t cents) {
+	return xm_queue_command(queue, (xm_command_t){
+			.type = COMMAND_TRANSPOSE,
+			.args = { (uint8_t)semitones, (uint8_t)cents },
+		});
+}
+
+void xm_drain_commands(xm_context_t* ctx, xm_command_queue_t* queue) {
+	uint32_t first;
+	uint32_t count = xm_ring_acquire_read(&queue->ring, &first);
+
+	for(uint32_t i = 0; i < count; ++i) {
+		const xm_command_t* cmd = queue->commands
+			+ ((first + i) & queue->ring.mask);
+		switch(cmd->type) {
+		case COMMAND_SEEK:
+			xm_seek(ctx, cmd->args[0], cmd->args[1], cmd->args[2]);
+			break;
+		case COMMAND_MUTE_CHANNEL:
+			xm_mute_channel(ctx, cmd->args[0], cmd->args[1]);
+			break;
+		case COMMAND_MUTE_INSTRUMENT:
+			xm_mute_instrument(ctx, cmd->args[0], cmd->args[1]);
+			break;
+		case COMMAND_MAX_LOOP_COUNT:
+			xm_set_max_loop_count(ctx, cmd->args[0]);
+			break;
+		case COMMAND_SAMPLE_RATE:
+			xm_set_sample_rate(ctx, cmd->value);
+			break;
+		case COMMAND_TEMPO_SCALE:
+			xm_set_tempo_scale(ctx, cmd->value);
+			break;
+		case COMMAND_TRANSPOSE:
+			xm_set_transpose(ctx, (int8_t)cmd->args[0],
+			                 (int8_t)cmd->args[1]);
+			break;
+		}
+	}
+
+	xm_ring_release_read(&queue->ring, count);
+}
@@ -0,0 +1,116 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+
+/* Generated by CMake, defines XM_VARIANT_TABLES(X) with one X(table) per
+   xm_add_variant() */
+#include "xm_variants.h"
+
+/* Fields of XM_DISABLED_FEATURES that hardcode a value instead of disabling
+   a feature */
+#define HARDCODED_FEATURES (~(((uint64_t)1 << FEATURE_VARIABLE_TEMPO) - 1))
+
+#define XM_VARIANT_EXTERN(v) \
+	extern const xm_variant_t v __attribute__((visibility("hidden")));
+XM_VARIANT_TABLES(XM_VARIANT_EXTERN)
+#undef XM_VARIANT_EXTERN
+
+static const xm_variant_t* const variants[] = {
+	&xm_variant,
+	#define XM_VARIANT_POINTER(v) &v,
+	XM_VARIANT_TABLES(XM_VARIANT_POINTER)
+	#undef XM_VARIANT_POINTER
+};
+#define NUM_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+static_assert(NUM_VARIANTS <= UINT8_MAX);
+
+/* Same condition as the warning in xm_analyze_module() */
+#define ACCURATE_ANALYSIS (XM_DISABLED_FEATURES == 0 \
+                           && XM_DISABLED_EFFECTS == 0 \
+                           && XM_LOOPING_TYPE == 2)
+
+/* ----- Static functions ----- */
+
+static bool xm_variant_plays(const xm_variant_t*, const xm_analysis_t*)
+	__attribute__((nonnull));
+static bool xm_hardcoded_field_plays(uint64_t, uint64_t, uint8_t, uint8_t);
+static uint8_t xm_variant_leanness(const xm_variant_t*)
+	__attribute__((nonnull));
+
+/* ----- Function definitions ----- */
+
+const xm_variant_t* xm_get_variant(uint8_t index) {
+	return index < NUM_VARIANTS ? variants[index] : nullptr;
+}
+
+static bool xm_hardcoded_field_plays(uint64_t variant, uint64_t analysis,
+                                     uint8_t shift, uint8_t bits) {
+	uint64_t mask = ((uint64_t)1 << bits) - 1;
+	variant = (variant >> shift) & mask;
+	return variant == 0 || variant == ((analysis >> shift) & mask);
+}
+
+static bool xm_variant_plays(const xm_variant_t* v, const xm_analysis_t* a) {
+	/* Everything disabled in the variant must be unused by the module */
+	if(v->disabled_effects & ~a->disabled_effects) return false;
+	if(v->disabled_volume_effects & ~a->disabled_volume_effects) {
+		return false;
+	}
+	if(v->disabled_features & ~a->disabled_features & ~HARDCODED_FEATURES) {
+		return false;
+	}
+
+	/* Hardcoded values must be variable (0) or match exactly */
+	if(!xm_hardcoded_field_plays(v->disabled_features, a->disabled_features,
+	                             FEATURE_VARIABLE_TEMPO, 5)
+	   || !xm_hardcoded_field_plays(v->disabled_features,
+	                                a->disabled_features,
+	                                FEATURE_VARIABLE_BPM, 8)
+	   || !xm_hardcoded_field_plays(v->disabled_features,
+	                                a->disabled_features,
+	                                FEATURE_VARIABLE_CHANNEL_COUNT, 8)) {
+		return false;
+	}
+
+	/* Full stereo panning plays any module */
+	return v->panning_type == 8 || v->panning_type == a->panning_type;
+}
+
+static uint8_t xm_variant_leanness(const xm_variant_t* v) {
+	return (uint8_t)(stdc_count_ones(v->disabled_effects)
+	                 + stdc_count_ones(v->disabled_volume_effects)
+	                 + stdc_count_ones(v->disabled_features)
+	                 + (v->panning_type != 8));
+}
+
+const xm_variant_t* xm_select_variant(char* restrict pool,
+                                      const xm_prescan_data_t* restrict p,
+                                      const char* restrict moddata,
+                                      uint32_t moddata_length) {
+	if(!ACCURATE_ANALYSIS) {
+		/* The analysis would miss what this build cannot play, only
+		   the base variant is safe */
+		return variants[0];
+	}
+
+	xm_analysis_t a;
+	xm_analyze_module(xm_create_context(pool, p, moddata, moddata_length),
+	                  &a);
+
+	/* Ties go to the variant added first */
+	const xm_variant_t* best = variants[0];
+	for(uint8_t i = 1; i < NUM_VARIANTS; ++i) {
+		if(xm_variant_plays(variants[i], &a)
+		   && xm_variant_leanness(variants[i])
+		      > xm_variant_leanness(best)) {
+			best = variants[i];
+		}
+	}
+	return best;
+}
@@ -0,0 +1,8 @@
+# Writes the bytes of INPUT as a comma separated list, to #include in an array
+# initializer (like #embed, that not all C compilers support yet).
+#
+# Usage: cmake -DINPUT=... -DOUTPUT=... -P <this file>
+
+file(READ ${INPUT} HEX HEX)
+string(REGEX REPLACE "(..)" "0x\\1," BYTES "${HEX}")
+file(WRITE ${OUTPUT} "${BYTES}\n")
@@ -67,16 +67,24 @@
 	_Generic((xm_sample_point_t){}, int8_t: (v), int16_t: ((v) * 256), \
 	         float: (float)(v) / 128.f)
 
-#define SAMPLE_POINT_FROM_S16(v) \
-	_Generic((xm_sample_point_t){}, int8_t: xm_dither_16b_8b(v), \
+/* idx is the index of the sample point in ctx->samples_data, used to seed
+   dithering noise */
+#define SAMPLE_POINT_FROM_S16(v, idx) \
+	_Generic((xm_sample_point_t){}, int8_t: xm_dither_16b_8b(v, idx), \
 		int16_t: (v), float: (float)(v) / 32768.f)
 
-#define SAMPLE_POINT_FROM_F32(v) \
+#define SAMPLE_POINT_FROM_F32(v, idx) \
 	_Generic((xm_sample_point_t){}, \
-	         int8_t: xm_dither_16b_8b((int16_t)((v) * 32768.f)), \
+	         int8_t: xm_dither_16b_8b((int16_t)((v) * 32768.f), idx), \
 	         int16_t: ((int16_t)((v) * 32768.f)), \
 	         float: (v))
 
+#define SAMPLE_POINT_TO_S16(v) \
+	_Generic((xm_sample_point_t){}, int8_t: (int16_t)((v) * 256), \
+	         int16_t: (v), \
+	         float: (int16_t)((v) >= 1.f ? INT16_MAX : \
+	                          ((v) <= -1.f ? INT16_MIN : (v) * 32768.f)))
+
 /* Type punning helpers */
 static uint32_t F32_TO_U32(_Float32 x) {
 	uint32_t y;
@@ -90,46 +98,147 @@ static _Float32 U32_TO_F32(uint32_t x) {
 	return y;
 }
 
-struct xm_prescan_data_s {
-	uint32_t context_size;
-	static_assert(MAX_PATTERNS * MAX_ROWS_PER_PATTERN <= 0xFFFFFF);
-	enum:uint8_t {
-		XM_FORMAT_XMIF,
-		XM_FORMAT_XM0104,
-		XM_FORMAT_MOD,
-		XM_FORMAT_MOD_FLT8, /* FLT8 requires special logic for its
-		                       pattern data */
-		XM_FORMAT_S3M,
-	} format;
-	uint32_t num_rows:24;
-	uint32_t samples_data_length;
-	uint16_t num_patterns;
+/* Dithering noise (0..255) of the sample point at index idx. This is a hash
+   of the index, not a RNG with state: conversions are reentrant, and give
+   the same results in any order. Works with scalars and vectors of
+   uint32_t. */
+#define DITHER_NOISE(idx) \
+	(((((idx) * 0x9E3779B1u) ^ (((idx) * 0x9E3779B1u) >> 15)) \
+	  * 0x2C1B3C6Du) >> 24)
+
+/* Sample data helpers (delta coding, conversions). These use generic
+   vectors, which the compiler lowers to SSE2/NEON/etc when available. When
+   optimizing for size, only the scalar loops are kept. */
+#if !defined(__OPTIMIZE_SIZE__)
+#define SAMPLE_VECTORS 1
+typedef int8_t xm_s8x16_t __attribute__((vector_size(16)));
+typedef int16_t xm_s16x8_t __attribute__((vector_size(16)));
+typedef uint8_t xm_u8x16_t __attribute__((vector_size(16)));
+typedef uint16_t xm_u16x8_t __attribute__((vector_size(16)));
+typedef int32_t xm_s32x8_t __attribute__((vector_size(32)));
+typedef uint32_t xm_u32x8_t __attribute__((vector_size(32)));
+typedef xm_sample_point_t xm_sample_point_x8_t
+	__attribute__((vector_size(8 * sizeof(xm_sample_point_t))));
+
+#define SAMPLE_POINTS_FROM_S16X8(x, idx) \
+	_Generic((xm_sample_point_t){}, \
+	         int8_t: __builtin_convertvector( \
+		         xm_dither_16b_8b_s16x8(x, idx), xm_sample_point_x8_t), \
+	         int16_t: (x), \
+	         float: __builtin_convertvector(x, xm_sample_point_x8_t) \
+	                * (xm_sample_point_t)(1.f / 32768.f))
+
+/* Shift the lanes of x up by k, shifting in the first k lanes of c */
+#define LANE_SHIFT(k, n, i) ((i) < (k) ? (i) : (n) + (i) - (k))
+#define SHIFT_S8X16(c, x, k) __builtin_shufflevector((c), (x), \
+	LANE_SHIFT(k, 16, 0), LANE_SHIFT(k, 16, 1), LANE_SHIFT(k, 16, 2), \
+	LANE_SHIFT(k, 16, 3), LANE_SHIFT(k, 16, 4), LANE_SHIFT(k, 16, 5), \
+	LANE_SHIFT(k, 16, 6), LANE_SHIFT(k, 16, 7), LANE_SHIFT(k, 16, 8), \
+	LANE_SHIFT(k, 16, 9), LANE_SHIFT(k, 16, 10), LANE_SHIFT(k, 16, 11), \
+	LANE_SHIFT(k, 16, 12), LANE_SHIFT(k, 16, 13), LANE_SHIFT(k, 16, 14), \
+	LANE_SHIFT(k, 16, 15))
+#define SHIFT_S16X8(c, x, k) __builtin_shufflevector((c), (x), \
+	LANE_SHIFT(k, 8, 0), LANE_SHIFT(k, 8, 1), LANE_SHIFT(k, 8, 2), \
+	LANE_SHIFT(k, 8, 3), LANE_SHIFT(k, 8, 4), LANE_SHIFT(k, 8, 5), \
+	LANE_SHIFT(k, 8, 6), LANE_SHIFT(k, 8, 7))
+#else
+#define SAMPLE_VECTORS 0
+#endif
+
+#if XM_LIBXM_DELTA_SAMPLES && !XM_ADPCM_SAMPLES
+/* Floats are left alone, in practice delta coding doesn't help them */
+#define DELTA_CODE_SAMPLES(fn, data, length) \
+	_Generic((xm_sample_point_t){}, \
+	         int8_t: xm_delta_##fn##_s8((int8_t*)(void*)(data), length), \
+	         int16_t: xm_delta_##fn##_s16((int16_t*)(void*)(data), length), \
+	         float: (void)0)
+#endif
+
+const uint8_t XM_PRESCAN_DATA_SIZE = sizeof(xm_prescan_data_t);
+
+/* Sample data of one XM instrument, to be decoded later. The samples already
+   have their final index in ctx->samples_data. */
+struct xm_sample_data_job_s {
+	uint32_t offset; /* of the first sample data, in moddata */
+	uint32_t headers; /* of the first sample header, in moddata */
+	uint16_t first_sample;
 	uint16_t num_samples;
-	uint16_t pot_length;
-	uint8_t num_channels;
-	uint8_t num_instruments;
 };
-const uint8_t XM_PRESCAN_DATA_SIZE = sizeof(xm_prescan_data_t);
+typedef struct xm_sample_data_job_s xm_sample_data_job_t;
+
+struct xm_sample_data_tasks_s {
+	xm_context_t* ctx;
+	const char* moddata;
+	uint32_t moddata_length;
+	xm_sample_data_job_t jobs[MAX_INSTRUMENTS];
+};
+typedef struct xm_sample_data_tasks_s xm_sample_data_tasks_t;
+
+/* Data seen so far in the module file, to find identical copies. Both the
+   prescan and the loader must feed the same data in the same order, to agree
+   on the context size. */
+#define DEDUP_ENTRIES 256
+#define DEDUP_DISABLED UINT32_MAX
+struct xm_dedup_entry_s {
+	uint32_t hash;
+	uint32_t offset; /* in moddata */
+	uint32_t length; /* in bytes */
+	uint32_t key; /* must also match, not part of the data */
+	uint32_t value;
+};
+typedef struct xm_dedup_entry_s xm_dedup_entry_t;
+
+struct xm_dedup_s {
+	xm_dedup_entry_t entries[DEDUP_ENTRIES];
+	uint32_t count; /* or DEDUP_DISABLED */
+};
+typedef struct xm_dedup_s xm_dedup_t;
 
 /* ----- Static functions ----- */
 
-static int8_t xm_dither_16b_8b(int16_t);
-static uint64_t xm_fnv1a(const unsigned char*, uint32_t) __attribute__((const));
+static int8_t xm_dither_16b_8b(int16_t, uint32_t) __attribute__((const));
+static void xm_store_sample_point(xm_context_t*, uint32_t, xm_sample_point_t) __attribute__((nonnull));
+#if SAMPLE_VECTORS
+static xm_s8x16_t xm_prefix_sum_s8x16(xm_s8x16_t, int8_t) __attribute__((const));
+static xm_s16x8_t xm_prefix_sum_s16x8(xm_s16x8_t, int16_t) __attribute__((const));
+static xm_s16x8_t xm_load_s16x8_le(const char*) __attribute__((nonnull));
+static xm_s16x8_t xm_dither_16b_8b_s16x8(xm_s16x8_t, uint32_t) __attribute__((const));
+#endif
+#if XM_LIBXM_DELTA_SAMPLES && !XM_ADPCM_SAMPLES
+static void xm_delta_encode_s8(int8_t*, uint32_t);
+static void xm_delta_encode_s16(int16_t*, uint32_t);
+static void xm_delta_decode_s8(int8_t*, uint32_t);
+static void xm_delta_decode_s16(int16_t*, uint32_t);
+#endif
+#if XM_DEDUPLICATE
+static uint32_t xm_dedup(xm_dedup_t*, const char*, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) __attribute__((nonnull));
+#endif
 static void xm_fixup_common(xm_context_t*);
+#if XM_PACKED_PATTERNS
+static void xm_pack_patterns(xm_context_t*) __attribute__((nonnull));
+#endif
+#ifdef XM_EMBEDDED_CONTEXT
+static void xm_restore_embedded_context(void);
+#endif
 
 static bool xm_prescan_xmif(const char*, uint32_t, xm_prescan_data_t*);
 static void xm_load_xmif(xm_context_t*, const char*, uint32_t);
 
+static uint32_t xm_state_row_loop_counters(const xm_context_t*) __attribute__((nonnull));
+static uint32_t xm_state_microsteps(uint32_t, uint8_t) __attribute__((const));
+
 static bool xm_prescan_xm0104(const char*, uint32_t, xm_prescan_data_t*);
-static void xm_load_xm0104(xm_context_t*, const char*, uint32_t);
+static void xm_load_xm0104(xm_context_t*, xm_sample_data_job_t*, const char*, uint32_t);
 static uint32_t xm_load_xm0104_module_header(xm_context_t*, uint8_t*, const char*, uint32_t);
-static uint32_t xm_load_xm0104_pattern(xm_context_t*, xm_pattern_t*, const char*, uint32_t, uint32_t);
-static uint32_t xm_load_xm0104_instrument(xm_context_t*, xm_instrument_t*, const char*, uint32_t, uint32_t);
+static uint32_t xm_load_xm0104_pattern(xm_context_t*, xm_pattern_t*, xm_dedup_t*, const char*, uint32_t, uint32_t);
+static uint32_t xm_load_xm0104_instrument(xm_context_t*, xm_instrument_t*, xm_sample_data_job_t*, xm_dedup_t*, const char*, uint32_t, uint32_t);
 [[maybe_unused]] static void xm_load_xm0104_envelope_points(xm_envelope_t*, const char*);
 [[maybe_unused]] static void xm_check_and_fix_envelope(xm_envelope_t*, uint8_t);
 static uint32_t xm_load_xm0104_sample_header(xm_sample_t*, bool*, const char*, uint32_t, uint32_t);
-static void xm_load_xm0104_8b_sample_data(uint32_t, xm_sample_point_t*, const char*, uint32_t, uint32_t);
-static void xm_load_xm0104_16b_sample_data(uint32_t, xm_sample_point_t*, const char*, uint32_t, uint32_t);
+static void xm_load_xm0104_sample_data(xm_context_t*, const xm_sample_data_job_t*, const char*, uint32_t);
+static void xm_load_xm0104_sample_data_task(void*, uint32_t);
+static void xm_load_xm0104_8b_sample_data(xm_context_t*, uint32_t, uint32_t, uint32_t, const char*, uint32_t, uint32_t);
+static void xm_load_xm0104_16b_sample_data(xm_context_t*, uint32_t, uint32_t, uint32_t, const char*, uint32_t, uint32_t);
 
 static bool xm_prescan_mod(const char*, uint32_t, xm_prescan_data_t*);
 static void xm_load_mod(xm_context_t*, const char*, uint32_t, const xm_prescan_data_t*);
@@ -246,12 +355,13 @@ bool xm_prescan_module(const char* restrict moddata, uint32_t moddata_length,
 	   || ckd_add(&sz, sz, sizeof(xm_instrument_t) * out->num_instruments)
 	   #endif
 	   || ckd_add(&sz, sz, sizeof(xm_sample_t) * out->num_samples)
-	   || ckd_add(&sz, sz, sizeof(xm_sample_point_t)
-	              * out->samples_data_length)
+	   || ckd_add(&sz, sz, SAMPLES_DATA_SIZE(out->samples_data_length))
 	   || ckd_add(&sz, sz, sizeof(xm_channel_context_t) * out->num_channels)
+	   #if XM_TRANSITIONS
+	   || ckd_add(&sz, sz, sizeof(xm_channel_context_t) * out->num_channels)
+	   #endif
 	   #if XM_LOOPING_TYPE == 2
-	   || ckd_add(&sz, sz, sizeof(uint8_t) * MAX_ROWS_PER_PATTERN
-	                                       * out->pot_length)
+	   || ckd_add(&sz, sz, sizeof(uint8_t) * out->pot_rows)
 	   #endif
 	   ) {
 		NOTICE("module too big for uint32");
@@ -279,6 +389,16 @@ xm_context_t* xm_create_context(char* restrict mempool,
                                 const xm_prescan_data_t* restrict p,
                                 const char* restrict moddata,
                                 uint32_t moddata_length) {
+	return xm_create_context_parallel(mempool, p, moddata, moddata_length,
+	                                  nullptr, nullptr);
+}
+
+xm_context_t* xm_create_context_parallel(char* restrict mempool,
+                                         const xm_prescan_data_t* restrict p,
+                                         const char* restrict moddata,
+                                         uint32_t moddata_length,
+                                         xm_parallel_for_t* parallel_for,
+                                         void* parallel_for_data) {
 	/* Make sure we are not misaligning data by accident */
 	ASSERT_ALIGNED(mempool, xm_context_t);
 	uint32_t ctx_size = xm_size_for_context(p);
@@ -290,6 +410,11 @@ xm_context_t* xm_create_context(char* restrict mempool,
 	ctx->channels = (xm_channel_context_t*)mempool;
 	mempool += sizeof(xm_channel_context_t) * p->num_channels;
 
+	#if XM_TRANSITIONS
+	ctx->fading_channels = (xm_channel_context_t*)mempool;
+	mempool += sizeof(xm_channel_context_t) * p->num_channels;
+	#endif
+
 	#if HAS_INSTRUMENTS
 	ASSERT_ALIGNED(mempool, xm_instrument_t);
 	ctx->instruments = (xm_instrument_t*)mempool;
@@ -304,9 +429,9 @@ xm_context_t* xm_create_context(char* restrict mempool,
 	ctx->patterns = (xm_pattern_t*)mempool;
 	mempool += sizeof(xm_pattern_t) * p->num_patterns;
 
-	ASSERT_ALIGNED(mempool, xm_sample_point_t);
-	ctx->samples_data = (xm_sample_point_t*)mempool;
-	mempool += sizeof(xm_sample_point_t) * p->samples_data_length;
+	ASSERT_ALIGNED(mempool, xm_samples_data_t);
+	ctx->samples_data = (xm_samples_data_t*)mempool;
+	mempool += SAMPLES_DATA_SIZE(p->samples_data_length);
 
 	ASSERT_ALIGNED(mempool, xm_pattern_slot_t);
 	ctx->pattern_slots = (xm_pattern_slot_t*)mempool;
@@ -315,7 +440,7 @@ xm_context_t* xm_create_context(char* restrict mempool,
 	#if XM_LOOPING_TYPE == 2
 	ASSERT_ALIGNED(mempool, uint8_t);
 	ctx->row_loop_count = (uint8_t*)mempool;
-	mempool += sizeof(uint8_t) * MAX_ROWS_PER_PATTERN * p->pot_length;
+	mempool += sizeof(uint8_t) * p->pot_rows;
 	#endif
 
 	assert(mempool - (char*)ctx == ctx_size);
@@ -325,9 +450,23 @@ xm_context_t* xm_create_context(char* restrict mempool,
 		xm_load_xmif(ctx, moddata, moddata_length);
 		break;
 
-	case XM_FORMAT_XM0104:
-		xm_load_xm0104(ctx, moddata, moddata_length);
+	case XM_FORMAT_XM0104: {
+		/* The ADPCM encoder state is kept in the context, sample data
+		   has to be encoded sequentially */
+		if(parallel_for == nullptr || XM_ADPCM_SAMPLES) {
+			xm_load_xm0104(ctx, nullptr, moddata, moddata_length);
+			break;
+		}
+		xm_sample_data_tasks_t tasks = {
+			.ctx = ctx,
+			.moddata = moddata,
+			.moddata_length = moddata_length,
+		};
+		xm_load_xm0104(ctx, tasks.jobs, moddata, moddata_length);
+		parallel_for(parallel_for_data, p->num_instruments,
+		             xm_load_xm0104_sample_data_task, &tasks);
 		break;
+	}
 
 	case XM_FORMAT_MOD:
 		xm_load_mod(ctx, moddata, moddata_length, p);
@@ -353,9 +492,25 @@ xm_context_t* xm_create_context(char* restrict mempool,
 	assert(NUM_INSTRUMENTS(&ctx->module) == p->num_instruments);
 	assert(ctx->module.num_samples == p->num_samples);
 	assert(ctx->module.samples_data_length == p->samples_data_length);
+
+	#if XM_PACKED_PATTERNS
+	ctx->module.pattern_data_length = (uint32_t)sizeof(xm_pattern_slot_t)
+		* p->num_rows * p->num_channels;
+	#endif
 	assert(xm_dump_size(ctx) == ctx_size);
 
+	#if XM_TEMPO_SCALING
+	ctx->module.tempo_scale = TEMPO_SCALE_UNITY;
+	#endif
+	#if XM_TRANSPOSE
+	ctx->module.pitch_scale = PITCH_SCALE_UNITY;
+	#endif
 	xm_fixup_common(ctx);
+	#if XM_PACKED_PATTERNS
+	/* The end of the pool is unused after this; use xm_dump_size() and
+	   xm_dump_context() to get a smaller copy of the context */
+	xm_pack_patterns(ctx);
+	#endif
 	xm_reset_context(ctx);
 	return ctx;
 }
@@ -430,38 +585,270 @@ static void xm_fixup_common(xm_context_t* ctx) {
 	}
 }
 
+#if XM_PACKED_PATTERNS
+static void xm_pack_patterns(xm_context_t* ctx) {
+	/* Patterns are usually stored in order, but nothing in XMIF requires
+	   it */
+	uint8_t order[MAX_PATTERNS];
+	for(uint16_t i = 0; i < ctx->module.num_patterns; ++i) {
+		uint16_t j = i;
+		for(; j > 0 && ctx->patterns[order[j-1]].rows_index
+			    > ctx->patterns[i].rows_index; --j) {
+			order[j] = order[j-1];
+		}
+		order[j] = (uint8_t)i;
+	}
+
+	/* Packed slots are never larger than unpacked slots, so out never
+	   overtakes s */
+	const xm_pattern_slot_t* s = ctx->pattern_slots;
+	uint8_t* out = (uint8_t*)ctx->pattern_slots;
+	uint16_t k = 0;
+	for(uint32_t row = 0; row < ctx->module.num_rows; ++row) {
+		for(; k < ctx->module.num_patterns
+			    && ctx->patterns[order[k]].rows_index == row; ++k) {
+			ctx->patterns[order[k]].data_offset =
+				(uint32_t)(out - (uint8_t*)ctx->pattern_slots);
+		}
+
+		for(uint8_t ch = 0; ch < NUM_CHANNELS(&ctx->module);
+		    ++ch, ++s) {
+			xm_pattern_slot_t slot = *s;
+			uint8_t mask = PACKED_SLOT_MASK
+				| (slot.note ? PACKED_SLOT_NOTE : 0)
+				| (slot.instrument ? PACKED_SLOT_INSTRUMENT : 0)
+				| (VOLUME_COLUMN(&slot) ?
+				   PACKED_SLOT_VOLUME_COLUMN : 0)
+				| (slot.effect_type ? PACKED_SLOT_EFFECT_TYPE : 0)
+				| (slot.effect_param ?
+				   PACKED_SLOT_EFFECT_PARAM : 0);
+
+			if(mask == (PACKED_SLOT_MASK | PACKED_SLOT_NOTE
+			            | PACKED_SLOT_INSTRUMENT
+			            | (HAS_VOLUME_COLUMN ?
+			               PACKED_SLOT_VOLUME_COLUMN : 0)
+			            | PACKED_SLOT_EFFECT_TYPE
+			            | PACKED_SLOT_EFFECT_PARAM)) {
+				if(slot.note == NOTE_KEY_OFF) {
+					slot.note = PACKED_NOTE_KEY_OFF;
+				}
+				assert(!(slot.note & PACKED_SLOT_MASK));
+				__builtin_memcpy(out, &slot, sizeof(slot));
+				out += sizeof(slot);
+				continue;
+			}
+
+			*out++ = mask;
+			if(slot.note) *out++ = slot.note;
+			if(slot.instrument) *out++ = slot.instrument;
+			#if HAS_VOLUME_COLUMN
+			if(slot.volume_column) *out++ = slot.volume_column;
+			#endif
+			if(slot.effect_type) *out++ = slot.effect_type;
+			if(slot.effect_param) *out++ = slot.effect_param;
+		}
+	}
+
+	ctx->module.pattern_data_length =
+		(uint32_t)(out - (uint8_t*)ctx->pattern_slots);
+
+	#if XM_LOOPING_TYPE == 2
+	/* Move the next region down, it will be zeroed by
+	   xm_reset_context() */
+	ctx->row_loop_count = out;
+	#endif
+}
+#endif
+
 uint32_t xm_size_for_context(const xm_prescan_data_t* p) {
 	return p->context_size;
 }
 
-static int8_t xm_dither_16b_8b(int16_t x) {
-	static uint32_t state = 0; /* XXX: make me reentrant */
-	return (x >= 32512) ? 127 :
-		(int8_t)((x + (int16_t)(xm_rand16(&state) % 256)) / 256);
+static int8_t xm_dither_16b_8b(int16_t x, uint32_t idx) {
+	int32_t y = (x + (int32_t)DITHER_NOISE(idx)) / 256;
+	/* Only reachable with x >= 32512 */
+	return (int8_t)(y > 127 ? 127 : y);
+}
+
+/* Sample points of a block must be stored in order, without skipping any
+   index: with XM_ADPCM_SAMPLES, the encoder state is carried over from one
+   call to the next. Every block is encoded from its own frames only, so that
+   identical data at block-aligned offsets always decodes identically. */
+static void xm_store_sample_point(xm_context_t* ctx, uint32_t idx,
+                                  xm_sample_point_t v) {
+	#if XM_ADPCM_SAMPLES
+	int16_t s = SAMPLE_POINT_TO_S16(v);
+	uint8_t* block = ctx->samples_data
+		+ idx / ADPCM_BLOCK_FRAMES * ADPCM_BLOCK_SIZE;
+	uint32_t j = idx % ADPCM_BLOCK_FRAMES;
+	if(j == 0) {
+		/* Store the first frame of every block verbatim, so blocks can
+		   be decoded independently */
+		ctx->adpcm_predictor = s;
+		block[0] = (uint8_t)s;
+		block[1] = (uint8_t)((uint16_t)s >> 8);
+		return;
+	}
+	if(j == 1) {
+		/* Seed the step index from the first delta of the block */
+		ctx->adpcm_index = xm_adpcm_initial_index(s
+		                                          - ctx->adpcm_predictor);
+		block[2] = ctx->adpcm_index;
+	}
+	block[4 + j / 2] |= (uint8_t)(xm_adpcm_encode(&ctx->adpcm_predictor,
+	                                              &ctx->adpcm_index, s)
+	                              << (4 * (j % 2)));
+	#else
+	ctx->samples_data[idx] = v;
+	#endif
+}
+
+/* ----- Delta coding ----- */
+
+#if SAMPLE_VECTORS
+/* Inclusive prefix sum of all lanes, plus carry, in log2(lanes) steps. Sums
+   are done on unsigned lanes, as signed lanes would overflow. */
+static xm_s8x16_t xm_prefix_sum_s8x16(xm_s8x16_t x, int8_t carry) {
+	xm_u8x16_t y = (xm_u8x16_t)x, zero = {};
+	y += SHIFT_S8X16(zero, y, 1);
+	y += SHIFT_S8X16(zero, y, 2);
+	y += SHIFT_S8X16(zero, y, 4);
+	y += SHIFT_S8X16(zero, y, 8);
+	return (xm_s8x16_t)(y + (uint8_t)carry);
+}
+
+static xm_s16x8_t xm_prefix_sum_s16x8(xm_s16x8_t x, int16_t carry) {
+	xm_u16x8_t y = (xm_u16x8_t)x, zero = {};
+	y += SHIFT_S16X8(zero, y, 1);
+	y += SHIFT_S16X8(zero, y, 2);
+	y += SHIFT_S16X8(zero, y, 4);
+	return (xm_s16x8_t)(y + (uint16_t)carry);
 }
 
+static xm_s16x8_t xm_load_s16x8_le(const char* p) {
+	xm_s16x8_t x;
+	__builtin_memcpy(&x, p, sizeof(x));
+	#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = (xm_s16x8_t)(((xm_u16x8_t)x << 8) | ((xm_u16x8_t)x >> 8));
+	#endif
+	return x;
+}
+
+/* Same as xm_dither_16b_8b(), for sample points idx..(idx+7) */
+static xm_s16x8_t xm_dither_16b_8b_s16x8(xm_s16x8_t x, uint32_t idx) {
+	xm_u32x8_t i = idx + (xm_u32x8_t){ 0, 1, 2, 3, 4, 5, 6, 7 };
+	xm_s32x8_t y = (__builtin_convertvector(x, xm_s32x8_t)
+	                + (xm_s32x8_t)DITHER_NOISE(i)) / 256;
+	y -= (y - 127) & (y > 127);
+	return __builtin_convertvector(y, xm_s16x8_t);
+}
+#endif
+
+#if XM_LIBXM_DELTA_SAMPLES && !XM_ADPCM_SAMPLES
+static void xm_delta_encode_s8(int8_t* data, uint32_t length) {
+	int8_t prev = 0;
+	uint32_t i = 0;
+	#if SAMPLE_VECTORS
+	for(; i + 16 <= length; i += 16) {
+		/* Unsigned lanes, see xm_prefix_sum_s8x16() */
+		xm_u8x16_t x, c = { (uint8_t)prev };
+		__builtin_memcpy(&x, data + i, sizeof(x));
+		prev = (int8_t)x[15];
+		x -= SHIFT_S8X16(c, x, 1);
+		__builtin_memcpy(data + i, &x, sizeof(x));
+	}
+	#endif
+	for(; i < length; ++i) {
+		int8_t x = data[i];
+		data[i] = (int8_t)(x - prev);
+		prev = x;
+	}
+}
+
+static void xm_delta_encode_s16(int16_t* data, uint32_t length) {
+	int16_t prev = 0;
+	uint32_t i = 0;
+	#if SAMPLE_VECTORS
+	for(; i + 8 <= length; i += 8) {
+		xm_u16x8_t x, c = { (uint16_t)prev };
+		__builtin_memcpy(&x, data + i, sizeof(x));
+		prev = (int16_t)x[7];
+		x -= SHIFT_S16X8(c, x, 1);
+		__builtin_memcpy(data + i, &x, sizeof(x));
+	}
+	#endif
+	for(; i < length; ++i) {
+		int16_t x = data[i];
+		data[i] = (int16_t)(x - prev);
+		prev = x;
+	}
+}
+
+static void xm_delta_decode_s8(int8_t* data, uint32_t length) {
+	int8_t v = 0;
+	uint32_t i = 0;
+	#if SAMPLE_VECTORS
+	for(; i + 16 <= length; i += 16) {
+		xm_s8x16_t x;
+		__builtin_memcpy(&x, data + i, sizeof(x));
+		x = xm_prefix_sum_s8x16(x, v);
+		v = x[15];
+		__builtin_memcpy(data + i, &x, sizeof(x));
+	}
+	#endif
+	for(; i < length; ++i) {
+		v += data[i];
+		data[i] = v;
+	}
+}
+
+static void xm_delta_decode_s16(int16_t* data, uint32_t length) {
+	int16_t v = 0;
+	uint32_t i = 0;
+	#if SAMPLE_VECTORS
+	for(; i + 8 <= length; i += 8) {
+		xm_s16x8_t x;
+		__builtin_memcpy(&x, data + i, sizeof(x));
+		x = xm_prefix_sum_s16x8(x, v);
+		v = x[7];
+		__builtin_memcpy(data + i, &x, sizeof(x));
+	}
+	#endif
+	for(; i < length; ++i) {
+		v += data[i];
+		data[i] = v;
+	}
+}
+#endif
+
 /* ----- Libxm dump, native endian ----- */
 
 uint32_t xm_dump_size(const xm_context_t* ctx) {
 	return (uint32_t)
 		(sizeof(xm_context_t)
 		 + sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module)
+		 #if XM_TRANSITIONS
+		 + sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module)
+		 #endif
 		 #if HAS_INSTRUMENTS
 		 + sizeof(xm_instrument_t) * ctx->module.num_instruments
 		 #endif
 		 + sizeof(xm_sample_t) * ctx->module.num_samples
 		 + sizeof(xm_pattern_t) * ctx->module.num_patterns
-		 + sizeof(xm_sample_point_t) * ctx->module.samples_data_length
+		 + SAMPLES_DATA_SIZE(ctx->module.samples_data_length)
+		 #if XM_PACKED_PATTERNS
+		 + ctx->module.pattern_data_length
+		 #else
 		 + sizeof(xm_pattern_slot_t) * ctx->module.num_rows
 		                             * NUM_CHANNELS(&ctx->module)
+		 #endif
 		 #if XM_LOOPING_TYPE == 2
-		 + sizeof(uint8_t) * ctx->module.length * MAX_ROWS_PER_PATTERN
+		 + sizeof(uint8_t) * xm_row_loop_index(ctx, ctx->module.length)
 		 #endif
 		 );
 }
 
-static uint64_t xm_fnv1a(const unsigned char* data, uint32_t length) {
-	uint64_t h = 14695981039346656037UL;
+uint64_t xm_fnv1a(uint64_t h, const unsigned char* data, uint32_t length) {
 	for(uint32_t i = 0; i < length; ++i) {
 		h ^= data[i];
 		h *= 1099511628211UL;
@@ -469,6 +856,44 @@ static uint64_t xm_fnv1a(const unsigned char* data, uint32_t length) {
 	return h;
 }
 
+#if XM_DEDUPLICATE
+/* Look for an identical copy of moddata[offset..(offset+length)], with the
+   same key. Returns the value of the copy if found, otherwise remembers this
+   data and returns value. Data that is not entirely in bounds is never
+   shared. */
+static uint32_t xm_dedup(xm_dedup_t* d,
+                         const char* moddata, uint32_t moddata_length,
+                         uint32_t offset, uint32_t length,
+                         uint32_t key, uint32_t value) {
+	if(d->count == DEDUP_DISABLED || offset > moddata_length
+	   || length > moddata_length - offset) {
+		return value;
+	}
+
+	uint32_t hash = (uint32_t)xm_fnv1a(FNV1A_BASIS, (const unsigned char*)moddata
+	                                   + offset, length);
+	for(uint32_t i = 0; i < d->count; ++i) {
+		const xm_dedup_entry_t* e = d->entries + i;
+		if(e->hash == hash && e->length == length && e->key == key
+		   && __builtin_memcmp(moddata + e->offset, moddata + offset,
+		                       length) == 0) {
+			return e->value;
+		}
+	}
+
+	if(d->count < DEDUP_ENTRIES) {
+		d->entries[d->count++] = (xm_dedup_entry_t){
+			.hash = hash,
+			.offset = offset,
+			.length = length,
+			.key = key,
+			.value = value,
+		};
+	}
+	return value;
+}
+#endif
+
 #define CALC_OFFSET(dest, orig) do { \
 		(dest) = (void*)((intptr_t)(dest) - (intptr_t)(orig)); \
 	} while(0)
@@ -489,6 +914,14 @@ void xm_dump_context(xm_context_t* restrict ctx, char* restrict out) {
 		ch->sample = 0;
 		ch->current = 0;
 	}
+	#if XM_SFX_VOICES
+	__builtin_memset(ctx->sfx_voices, 0, sizeof(ctx->sfx_voices));
+	#endif
+	#if XM_TRANSITIONS
+	__builtin_memset(ctx->fading_channels, 0, sizeof(xm_channel_context_t)
+	                 * NUM_CHANNELS(&ctx->module));
+	ctx->crossfade_remaining = 0;
+	#endif
 	/* Force next generated samples to call xm_row() and refill
 	  ch->current */
 	ctx->current_tick = 0;
@@ -497,15 +930,11 @@ void xm_dump_context(xm_context_t* restrict ctx, char* restrict out) {
 	/* (*) Everything done after this should be deterministically
 	   reversible */
 	uint32_t ctx_size = xm_dump_size(ctx);
-	[[maybe_unused]] uint64_t old_hash = xm_fnv1a((void*)ctx, ctx_size);
+	[[maybe_unused]] uint64_t old_hash = xm_fnv1a(FNV1A_BASIS, (void*)ctx, ctx_size);
 
-	#if XM_LIBXM_DELTA_SAMPLES
-	/* Do nothing for floats, in practice this doesn't help */
-	if(_Generic((xm_sample_point_t){}, float: false, default: true)) {
-		for(uint32_t i = ctx->module.samples_data_length-1; i > 0; --i) {
-			ctx->samples_data[i] -= ctx->samples_data[i-1];
-		}
-	}
+	#if XM_LIBXM_DELTA_SAMPLES && !XM_ADPCM_SAMPLES
+	DELTA_CODE_SAMPLES(encode, ctx->samples_data,
+	                   ctx->module.samples_data_length);
 	#endif
 
 	CALC_OFFSET(ctx->patterns, ctx);
@@ -518,17 +947,28 @@ void xm_dump_context(xm_context_t* restrict ctx, char* restrict out) {
 	CALC_OFFSET(ctx->samples, ctx);
 	CALC_OFFSET(ctx->samples_data, ctx);
 	CALC_OFFSET(ctx->channels, ctx);
+	#if XM_TRANSITIONS
+	CALC_OFFSET(ctx->fading_channels, ctx);
+	#endif
 
 	#if XM_LOOPING_TYPE == 2
 	CALC_OFFSET(ctx->row_loop_count, ctx);
 	#endif
 
 	__builtin_memcpy(out, ctx, ctx_size);
+	#if XM_TRACE
+	__builtin_memset(out + offsetof(xm_context_t, module.trace), 0,
+	                 sizeof(xm_trace_t*));
+	#endif
+	#if XM_COMMAND_QUEUE
+	__builtin_memset(out + offsetof(xm_context_t, module.commands), 0,
+	                 sizeof(xm_command_queue_t*));
+	#endif
 
 	/* Restore the context back to the state marked (*) */
 	ctx = xm_restore_context((void*)ctx);
 
-	assert(xm_fnv1a((void*)ctx, ctx_size) == old_hash);
+	assert(xm_fnv1a(FNV1A_BASIS, (void*)ctx, ctx_size) == old_hash);
 }
 
 xm_context_t* xm_restore_context(char* data) {
@@ -546,20 +986,232 @@ xm_context_t* xm_restore_context(char* data) {
 	APPLY_OFFSET(ctx->samples, ctx);
 	APPLY_OFFSET(ctx->samples_data, ctx);
 	APPLY_OFFSET(ctx->channels, ctx);
+	#if XM_TRANSITIONS
+	APPLY_OFFSET(ctx->fading_channels, ctx);
+	#endif
 
 	#if XM_LOOPING_TYPE == 2
 	APPLY_OFFSET(ctx->row_loop_count, ctx);
 	#endif
 
-	#if XM_LIBXM_DELTA_SAMPLES
-	if(_Generic((xm_sample_point_t){}, float: false, default: true)) {
-		for(uint32_t i = 1; i < ctx->module.samples_data_length; ++i) {
-			ctx->samples_data[i] += ctx->samples_data[i-1];
+	#if XM_LIBXM_DELTA_SAMPLES && !XM_ADPCM_SAMPLES
+	DELTA_CODE_SAMPLES(decode, ctx->samples_data,
+	                   ctx->module.samples_data_length);
+	#endif
+
+	return ctx;
+}
+
+#ifdef XM_EMBEDDED_CONTEXT
+#include <threads.h>
+
+/* Comma separated bytes of a xm_dump_context() of this build, written by
+   xm_add_specialized() */
+static _Alignas(max_align_t) unsigned char embedded_context[] = {
+	#include XM_EMBEDDED_CONTEXT
+};
+static xm_context_t* restored_embedded_context;
+static once_flag embedded_context_once = ONCE_FLAG_INIT;
+
+static void xm_restore_embedded_context(void) {
+	restored_embedded_context =
+		xm_restore_context((char*)embedded_context);
+}
+#endif
+
+xm_context_t* xm_embedded_context(void) {
+	#ifdef XM_EMBEDDED_CONTEXT
+	/* The first calls may come from several threads at once */
+	call_once(&embedded_context_once, xm_restore_embedded_context);
+	return restored_embedded_context;
+	#else
+	return nullptr;
+	#endif
+}
+
+void xm_rebase_context(xm_context_t* ctx, const xm_context_t* old) {
+	#define REBASE(p) do { \
+			if(p) { \
+				CALC_OFFSET((p), old); \
+				APPLY_OFFSET((p), ctx); \
+			} \
+		} while(0)
+
+	REBASE(ctx->patterns);
+	REBASE(ctx->pattern_slots);
+	#if HAS_INSTRUMENTS
+	REBASE(ctx->instruments);
+	#endif
+	REBASE(ctx->samples);
+	REBASE(ctx->samples_data);
+	REBASE(ctx->channels);
+	#if XM_TRANSITIONS
+	REBASE(ctx->fading_channels);
+	#endif
+	#if XM_LOOPING_TYPE == 2
+	REBASE(ctx->row_loop_count);
+	#endif
+
+	for(uint16_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		#if HAS_INSTRUMENTS
+		REBASE(ch->instrument);
+		#endif
+		REBASE(ch->sample);
+		REBASE(ch->current);
+	}
+
+	#if XM_TRANSITIONS
+	for(uint16_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_channel_context_t* ch = ctx->fading_channels + i;
+		#if HAS_INSTRUMENTS
+		REBASE(ch->instrument);
+		#endif
+		REBASE(ch->sample);
+	}
+	#endif
+
+	#if XM_SFX_VOICES
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		xm_channel_context_t* ch = &ctx->sfx_voices[i].ch;
+		#if HAS_INSTRUMENTS
+		REBASE(ch->instrument);
+		#endif
+		REBASE(ch->sample);
+		REBASE(ch->current);
+	}
+	#endif
+
+	#undef REBASE
+
+	#if XM_TRACE
+	/* Only one context can write to a trace */
+	ctx->module.trace = nullptr;
+	#endif
+	#if XM_COMMAND_QUEUE
+	/* Only one context can read from a command queue */
+	ctx->module.commands = nullptr;
+	#endif
+}
+
+uint32_t xm_clone_size(const xm_context_t* ctx) {
+	return (uint32_t)
+		(sizeof(xm_context_t)
+		 + sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module)
+		 #if XM_TRANSITIONS
+		 + sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module)
+		 #endif
+		 #if HAS_INSTRUMENTS
+		 + sizeof(xm_instrument_t) * ctx->module.num_instruments
+		 #endif
+		 + sizeof(xm_sample_t) * ctx->module.num_samples
+		 #if XM_LOOPING_TYPE == 2
+		 + sizeof(uint8_t) * xm_row_loop_index(ctx, ctx->module.length)
+		 #endif
+		 );
+}
+
+xm_context_t* xm_clone_context(char* restrict pool,
+                               const xm_context_t* restrict ctx) {
+	ASSERT_ALIGNED(pool, xm_context_t);
+	xm_context_t* clone = (xm_context_t*)pool;
+	*clone = *ctx;
+	pool += sizeof(xm_context_t);
+	#if XM_TRACE
+	clone->module.trace = nullptr;
+	#endif
+	#if XM_COMMAND_QUEUE
+	clone->module.commands = nullptr;
+	#endif
+
+	/* Copy everything that can change during playback (instruments and
+	   samples have trigger times and mute flags). Patterns and sample
+	   data stay shared. */
+	ASSERT_ALIGNED(pool, xm_channel_context_t);
+	clone->channels = (xm_channel_context_t*)pool;
+	pool += sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module);
+	__builtin_memcpy(clone->channels, ctx->channels,
+	                 sizeof(xm_channel_context_t)
+	                 * NUM_CHANNELS(&ctx->module));
+
+	#if XM_TRANSITIONS
+	clone->fading_channels = (xm_channel_context_t*)pool;
+	pool += sizeof(xm_channel_context_t) * NUM_CHANNELS(&ctx->module);
+	__builtin_memcpy(clone->fading_channels, ctx->fading_channels,
+	                 sizeof(xm_channel_context_t)
+	                 * NUM_CHANNELS(&ctx->module));
+	#endif
+
+	#if HAS_INSTRUMENTS
+	ASSERT_ALIGNED(pool, xm_instrument_t);
+	clone->instruments = (xm_instrument_t*)pool;
+	pool += sizeof(xm_instrument_t) * ctx->module.num_instruments;
+	__builtin_memcpy(clone->instruments, ctx->instruments,
+	                 sizeof(xm_instrument_t)
+	                 * ctx->module.num_instruments);
+	#endif
+
+	ASSERT_ALIGNED(pool, xm_sample_t);
+	clone->samples = (xm_sample_t*)pool;
+	pool += sizeof(xm_sample_t) * ctx->module.num_samples;
+	__builtin_memcpy(clone->samples, ctx->samples,
+	                 sizeof(xm_sample_t) * ctx->module.num_samples);
+
+	#if XM_LOOPING_TYPE == 2
+	clone->row_loop_count = (uint8_t*)pool;
+	__builtin_memcpy(clone->row_loop_count, ctx->row_loop_count,
+	                 xm_row_loop_index(ctx, ctx->module.length));
+	#endif
+
+	for(uint16_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_channel_context_t* ch = clone->channels + i;
+		#if HAS_INSTRUMENTS
+		if(ch->instrument) {
+			ch->instrument = clone->instruments
+				+ (ch->instrument - ctx->instruments);
+		}
+		#endif
+		if(ch->sample) {
+			ch->sample = clone->samples + (ch->sample - ctx->samples);
+		}
+		/* ch->current points to the (shared) pattern slots, unless
+		   they are packed */
+		#if XM_PACKED_PATTERNS
+		if(ch->current) {
+			ch->current = &ch->current_slot;
+		}
+		#endif
+	}
+
+	#if XM_TRANSITIONS
+	for(uint16_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_channel_context_t* ch = clone->fading_channels + i;
+		#if HAS_INSTRUMENTS
+		if(ch->instrument) {
+			ch->instrument = clone->instruments
+				+ (ch->instrument - ctx->instruments);
+		}
+		#endif
+		if(ch->sample) {
+			ch->sample = clone->samples + (ch->sample - ctx->samples);
 		}
 	}
 	#endif
 
-	return ctx;
+	#if XM_SFX_VOICES
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		xm_channel_context_t* ch = &clone->sfx_voices[i].ch;
+		if(ch->sample == NULL) continue;
+		#if HAS_INSTRUMENTS
+		ch->instrument = clone->instruments
+			+ (ch->instrument - ctx->instruments);
+		#endif
+		ch->sample = clone->samples + (ch->sample - ctx->samples);
+		ch->current = &clone->sfx_slot;
+	}
+	#endif
+
+	return clone;
 }
 
 /* ----- Libxm interchange format: little endian ----- */
@@ -659,6 +1311,32 @@ static bool xm_prescan_xmif(const char* restrict moddata,
 	out->pot_length = READ_U16(0x0A);
 	out->num_channels = READ_U8(0x19);
 	out->num_instruments = READ_U8(0x18);
+
+	if(out->pot_length > PATTERN_ORDER_TABLE_LENGTH) {
+		NOTICE("pattern order table too big");
+		return false;
+	}
+
+	/* Skip to the pattern order table to count rows */
+	uint64_t patterns = READ_U8(0) << 3;
+	uint64_t pot = patterns
+		+ (uint64_t)(READ_U8(0x20) << 3) * out->num_patterns
+		+ (uint64_t)(READ_U8(0x21) << 3) * num_rows * out->num_channels
+		+ (uint64_t)(READ_U8(0x22) << 3) * out->num_instruments
+		+ (uint64_t)(READ_U8(0x23) << 3) * out->num_samples
+		+ (uint64_t)4 * out->samples_data_length;
+	if(pot + 2 * out->pot_length > moddata_length) {
+		NOTICE("file too small");
+		return false;
+	}
+	out->pot_rows = 0;
+	for(uint16_t i = 0; i < out->pot_length; ++i) {
+		uint16_t pattern = READ_U16((uint32_t)pot + 2 * i);
+		out->pot_rows += (pattern < out->num_patterns) ?
+			READ_U16((uint32_t)patterns
+			         + (uint32_t)(READ_U8(0x20) << 3) * pattern + 2)
+			: 64;
+	}
 	return true;
 }
 
@@ -808,8 +1486,8 @@ static void xm_load_xmif(xm_context_t* restrict ctx,
 	}
 
 	for(uint32_t i = 0; i < ctx->module.samples_data_length; ++i) {
-		ctx->samples_data[i] =
-			SAMPLE_POINT_FROM_F32(U32_TO_F32(READ_U32(offset)));
+		xm_store_sample_point(ctx, i, SAMPLE_POINT_FROM_F32(
+			                      U32_TO_F32(READ_U32(offset)), i));
 		offset += 4;
 	}
 
@@ -891,15 +1569,26 @@ void xm_save_context(const xm_context_t* restrict ctx, char* restrict out) {
 		out += XMIF_PATTERN_SZ;
 	}
 
-	xm_pattern_slot_t* s = ctx->pattern_slots;
+	#if XM_PACKED_PATTERNS
+	xm_pattern_slot_t slot;
+	xm_pattern_slot_t* s = &slot;
+	uint32_t offset = 0;
+	#else
+	const xm_pattern_slot_t* s = ctx->pattern_slots;
+	#endif
 	for(uint32_t i = 0; i < ctx->module.num_rows; ++i) {
 		for(uint8_t j = 0; j < NUM_CHANNELS(&ctx->module); ++j) {
+			#if XM_PACKED_PATTERNS
+			offset = xm_unpack_slot(ctx, offset, &slot);
+			#endif
 			WRITE_U8(out, s->note);
 			WRITE_U8(out + 0x01, s->instrument);
 			WRITE_U8(out + 0x02, VOLUME_COLUMN(s));
 			WRITE_U8(out + 0x03, s->effect_type);
 			WRITE_U8(out + 0x04, s->effect_param);
+			#if !XM_PACKED_PATTERNS
 			s += 1;
+			#endif
 			out += XMIF_PATTERN_SLOT_SZ;
 		}
 	}
@@ -964,10 +1653,24 @@ void xm_save_context(const xm_context_t* restrict ctx, char* restrict out) {
 		out += XMIF_SAMPLE_SZ;
 	}
 
+	#if XM_ADPCM_SAMPLES
+	int16_t block[ADPCM_BLOCK_FRAMES];
+	for(uint32_t i = 0; i < ctx->module.samples_data_length; ++i) {
+		if(i % ADPCM_BLOCK_FRAMES == 0) {
+			xm_adpcm_decode_block(ctx->samples_data
+			                      + i / ADPCM_BLOCK_FRAMES
+			                      * ADPCM_BLOCK_SIZE, block);
+		}
+		WRITE_U32(out, F32_TO_U32((float)block[i % ADPCM_BLOCK_FRAMES]
+		                          / 32768.f));
+		out += 4;
+	}
+	#else
 	for(uint32_t i = 0; i < ctx->module.samples_data_length; ++i) {
 		WRITE_U32(out, F32_TO_U32(SAMPLE_DATA(ctx, i)));
 		out += 4;
 	}
+	#endif
 
 	for(uint16_t i = 0; i < ctx->module.length; ++i) {
 		WRITE_U16(out, ctx->module.pattern_table[i]);
@@ -975,6 +1678,759 @@ void xm_save_context(const xm_context_t* restrict ctx, char* restrict out) {
 	}
 }
 
+/* ----- Playback state: little endian ----- */
+
+/* Only what the module makes of playback is saved. What the caller sets on
+   top (tempo scale, transposition, transitions, sound effects) is not, see
+   xm_load_state() in xm.h.
+
+   Header:
+
+   0x00: u8, header size (in 8 byte blocks)
+   0x01: u8, format version (0: bump when breaking forward compat)
+   0x02: u8[8], 'LIBXMST', '\xFF'
+   0x0A: u8, number of channels
+   0x0B: u8, number of instruments
+   0x0C: u16, number of samples
+   0x0E: u16, number of pattern orders
+   0x10: u32, number of row loop counters (0: not saved)
+   0x14: u8, microstep bits of sample positions and steps
+   0x15: u8, number of ramping points per channel (0: not saved)
+   0x16: u16, sample rate
+   0x18: u32, remaining samples in tick (in 1/TICK_SUBSAMPLES frames)
+   0x1C: u32, generated samples
+   0x20: u16, current pattern order
+   0x22: u16, pattern of the slots currently read by channels (0xFFFF: none)
+   0x24: u16, row of the slots currently read by channels
+   0x26: u8, current tick
+   0x27: u8, current row
+   0x28: u8, extra rows done
+   0x29: u8, extra rows
+   0x2A: u8, global volume
+   0x2B: u8, tempo
+   0x2C: u8, BPM
+   0x2D: u8, jump destination
+   0x2E: u8, jump row
+   0x2F: u8, loop count
+   0x30: u8, flags (1: pattern break, 2: position jump)
+
+   Channel (followed by f32[number of ramping points], end of previous
+   sample):
+
+   0x00: u8, instrument + 1 (0: none)
+   0x01: u8, next instrument
+   0x02: u16, sample + 1 (0: none)
+   0x04: u32, latest trigger
+   0x08: u32, sample position (in microsteps)
+   0x0C: u32, step (in microsteps)
+   0x10: f32[2], actual volume (left, right)
+   0x18: f32[2], target volume (left, right)
+   0x20: u32, ramping frame count
+   0x24: u16, period
+   0x26: u16, tone portamento target period
+   0x28: u16, fadeout volume
+   0x2A: u16, autovibrato ticks
+   0x2C: u16, volume envelope frame count
+   0x2E: u16, panning envelope frame count
+   0x30: u8, volume envelope volume
+   0x31: u8, panning envelope panning
+   0x32: u8, volume
+   0x33: s8, volume offset
+   0x34: u8, panning
+   0x35: u8, base panning
+   0x36: u8, original note
+   0x37: s8, finetune
+   0x38: u8, volume slide param
+   0x39: u8, fine volume slide up param
+   0x3A: u8, fine volume slide down param
+   0x3B: u8, global volume slide param
+   0x3C: u8, panning slide param
+   0x3D: u8, portamento up param
+   0x3E: u8, portamento down param
+   0x3F: u8, fine portamento up param
+   0x40: u8, fine portamento down param
+   0x41: u8, extra fine portamento up param
+   0x42: u8, extra fine portamento down param
+   0x43: u8, glissando control param
+   0x44: s8, glissando control error
+   0x45: u8, tone portamento param
+   0x46: u8, multi retrig param
+   0x47: u8, multi retrig ticks
+   0x48: u8, pattern loop origin
+   0x49: u8, pattern loop count
+   0x4A: u8, sample offset param
+   0x4B: u8, tremolo param
+   0x4C: u8, tremolo ticks
+   0x4D: u8, tremolo control param
+   0x4E: u8, vibrato param
+   0x4F: u8, vibrato ticks
+   0x50: s8, vibrato offset
+   0x51: u8, vibrato control param
+   0x52: s8, autovibrato offset
+   0x53: u8, arpeggio note offset
+   0x54: u8, tremor param
+   0x55: u8, tremor ticks
+   0x56: u8, effect param (S3M effect memory)
+   0x57: u8, flags (1: sample offset invalid, 2: should reset vibrato,
+                    4: should reset arpeggio, 8: tremor on, 16: sustained,
+                    32: muted)
+
+   Instrument:
+
+   0x00: u32, latest trigger
+   0x04: u8, muted
+
+   Sample:
+
+   0x00: u32, latest trigger
+
+   Followed by u8[number of row loop counters].
+
+   Fields that are compiled out are saved with their implied value, and
+   ignored when loading. */
+
+#define STATE_HEADER_SZ 0x38
+#define STATE_CHANNEL_SZ 0x58
+#define STATE_INSTRUMENT_SZ 0x08
+#define STATE_SAMPLE_SZ 0x04
+#define STATE_RAMPING_POINTS (XM_RAMPING ? RAMPING_POINTS : 0)
+static_assert(STATE_HEADER_SZ % 8 == 0
+              && STATE_CHANNEL_SZ % 8 == 0
+              && STATE_INSTRUMENT_SZ % 8 == 0);
+
+static uint32_t xm_state_row_loop_counters([[maybe_unused]]
+                                           const xm_context_t* ctx) {
+	#if XM_LOOPING_TYPE == 2
+	return xm_row_loop_index(ctx, ctx->module.length);
+	#else
+	return 0;
+	#endif
+}
+
+uint32_t xm_state_size(const xm_context_t* ctx) {
+	return (uint32_t)(STATE_HEADER_SZ
+		+ NUM_CHANNELS(&ctx->module)
+		  * (STATE_CHANNEL_SZ + 4 * STATE_RAMPING_POINTS)
+		+ NUM_INSTRUMENTS(&ctx->module) * STATE_INSTRUMENT_SZ
+		+ ctx->module.num_samples * STATE_SAMPLE_SZ)
+		+ xm_state_row_loop_counters(ctx);
+}
+
+void xm_save_state(const xm_context_t* restrict ctx, char* restrict out) {
+	__builtin_memset(out, 0, xm_state_size(ctx));
+
+	WRITE_U8(out, STATE_HEADER_SZ / 8);
+	WRITE_U8(out + 0x01, 0); /* version */
+	__builtin_memcpy(out + 0x02, "LIBXMST\xFF", 8); /* magic */
+	WRITE_U8(out + 0x0A, NUM_CHANNELS(&ctx->module));
+	WRITE_U8(out + 0x0B, NUM_INSTRUMENTS(&ctx->module));
+	WRITE_U16(out + 0x0C, ctx->module.num_samples);
+	WRITE_U16(out + 0x0E, ctx->module.length);
+	WRITE_U32(out + 0x10, xm_state_row_loop_counters(ctx));
+	WRITE_U8(out + 0x14, XM_MICROSTEP_BITS);
+	WRITE_U8(out + 0x15, STATE_RAMPING_POINTS);
+	WRITE_U16(out + 0x16, CURRENT_SAMPLE_RATE(ctx));
+	WRITE_U32(out + 0x18, ctx->remaining_samples_in_tick);
+	#if XM_TIMING_FUNCTIONS
+	WRITE_U32(out + 0x1C, ctx->generated_samples);
+	#endif
+	WRITE_U16(out + 0x20, ctx->current_table_index);
+
+	/* All channels read slots of the same row, find it back from the
+	   first channel */
+	uint16_t slots_pattern = UINT16_MAX, slots_row = 0;
+	if(ctx->channels[0].current) {
+		#if XM_PACKED_PATTERNS
+		uint32_t r = ctx->next_packed_row - 1;
+		#else
+		uint32_t r = (uint32_t)(ctx->channels[0].current
+		                        - ctx->pattern_slots)
+		             / NUM_CHANNELS(&ctx->module);
+		#endif
+		for(uint16_t i = 0; i < ctx->module.num_patterns; ++i) {
+			const xm_pattern_t* p = ctx->patterns + i;
+			if(r >= p->rows_index && r - p->rows_index < p->num_rows) {
+				slots_pattern = i;
+				slots_row = (uint16_t)(r - p->rows_index);
+				break;
+			}
+		}
+		assert(slots_pattern != UINT16_MAX);
+	}
+	WRITE_U16(out + 0x22, slots_pattern);
+	WRITE_U16(out + 0x24, slots_row);
+
+	WRITE_U8(out + 0x26, ctx->current_tick);
+	WRITE_U8(out + 0x27, ctx->current_row);
+	WRITE_U8(out + 0x28, EXTRA_ROWS_DONE(ctx));
+	#if HAS_EFFECT(EFFECT_DELAY_PATTERN)
+	WRITE_U8(out + 0x29, ctx->extra_rows);
+	#endif
+	WRITE_U8(out + 0x2A, CURRENT_GLOBAL_VOLUME(ctx));
+	WRITE_U8(out + 0x2B, CURRENT_TEMPO(ctx));
+	WRITE_U8(out + 0x2C, CURRENT_BPM(ctx));
+	#if HAS_POSITION_JUMP
+	WRITE_U8(out + 0x2D, ctx->jump_dest);
+	#endif
+	#if HAS_JUMP_ROW
+	WRITE_U8(out + 0x2E, ctx->jump_row);
+	#endif
+	WRITE_U8(out + 0x2F, LOOP_COUNT(ctx));
+	WRITE_U8(out + 0x30, PATTERN_BREAK(ctx) | (POSITION_JUMP(ctx) << 1));
+	out += STATE_HEADER_SZ;
+
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		const xm_channel_context_t* ch = ctx->channels + i;
+		#if HAS_INSTRUMENTS
+		if(ch->instrument) {
+			WRITE_U8(out, ch->instrument - ctx->instruments + 1);
+		}
+		#endif
+		WRITE_U8(out + 0x01, ch->next_instrument);
+		if(ch->sample) {
+			WRITE_U16(out + 0x02, ch->sample - ctx->samples + 1);
+		}
+		#if XM_TIMING_FUNCTIONS
+		WRITE_U32(out + 0x04, ch->latest_trigger);
+		#endif
+		WRITE_U32(out + 0x08, ch->sample_position);
+		WRITE_U32(out + 0x0C, ch->step);
+		WRITE_U32(out + 0x10, F32_TO_U32(ch->actual_volume[0]));
+		WRITE_U32(out + 0x14, F32_TO_U32(ch->actual_volume[1]));
+		#if XM_RAMPING
+		WRITE_U32(out + 0x18, F32_TO_U32(ch->target_volume[0]));
+		WRITE_U32(out + 0x1C, F32_TO_U32(ch->target_volume[1]));
+		WRITE_U32(out + 0x20, ch->frame_count);
+		#endif
+		WRITE_U16(out + 0x24, ch->period);
+		#if HAS_TONE_PORTAMENTO
+		WRITE_U16(out + 0x26, ch->tone_portamento_target_period);
+		#endif
+		WRITE_U16(out + 0x28, FADEOUT_VOLUME(ch));
+		#if HAS_FEATURE(FEATURE_AUTOVIBRATO)
+		WRITE_U16(out + 0x2A, ch->autovibrato_ticks);
+		#endif
+		#if HAS_FEATURE(FEATURE_VOLUME_ENVELOPES)
+		WRITE_U16(out + 0x2C, ch->volume_envelope_frame_count);
+		#endif
+		#if HAS_PANNING && HAS_FEATURE(FEATURE_PANNING_ENVELOPES)
+		WRITE_U16(out + 0x2E, ch->panning_envelope_frame_count);
+		#endif
+		WRITE_U8(out + 0x30, VOLUME_ENVELOPE_VOLUME(ch));
+		WRITE_U8(out + 0x31, PANNING_ENVELOPE_PANNING(ch));
+		WRITE_U8(out + 0x32, ch->volume);
+		WRITE_U8(out + 0x33, VOLUME_OFFSET(ch));
+		#if HAS_PANNING
+		WRITE_U8(out + 0x34, ch->panning);
+		#else
+		WRITE_U8(out + 0x34, MAX_PANNING / 2);
+		#endif
+		WRITE_U8(out + 0x35, BASE_PANNING(ctx, i));
+		WRITE_U8(out + 0x36, ch->orig_note);
+		#if HAS_FINETUNES
+		WRITE_U8(out + 0x37, ch->finetune);
+		#endif
+		#if HAS_VOLUME_SLIDE
+		WRITE_U8(out + 0x38, ch->volume_slide_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_VOLUME_SLIDE_UP)
+		WRITE_U8(out + 0x39, ch->fine_volume_slide_up_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_VOLUME_SLIDE_DOWN)
+		WRITE_U8(out + 0x3A, ch->fine_volume_slide_down_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_GLOBAL_VOLUME_SLIDE)
+		WRITE_U8(out + 0x3B, ch->global_volume_slide_param);
+		#endif
+		#if HAS_PANNING && HAS_EFFECT(EFFECT_PANNING_SLIDE)
+		WRITE_U8(out + 0x3C, ch->panning_slide_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_PORTAMENTO_UP)
+		WRITE_U8(out + 0x3D, ch->portamento_up_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_PORTAMENTO_DOWN)
+		WRITE_U8(out + 0x3E, ch->portamento_down_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_PORTAMENTO_UP)
+		WRITE_U8(out + 0x3F, ch->fine_portamento_up_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_PORTAMENTO_DOWN)
+		WRITE_U8(out + 0x40, ch->fine_portamento_down_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_EXTRA_FINE_PORTAMENTO_UP)
+		WRITE_U8(out + 0x41, ch->extra_fine_portamento_up_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_EXTRA_FINE_PORTAMENTO_DOWN)
+		WRITE_U8(out + 0x42, ch->extra_fine_portamento_down_param);
+		#endif
+		#if HAS_GLISSANDO_CONTROL
+		WRITE_U8(out + 0x43, ch->glissando_control_param);
+		WRITE_U8(out + 0x44, ch->glissando_control_error);
+		#endif
+		#if HAS_TONE_PORTAMENTO
+		WRITE_U8(out + 0x45, ch->tone_portamento_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_MULTI_RETRIG_NOTE)
+		WRITE_U8(out + 0x46, ch->multi_retrig_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_MULTI_RETRIG_NOTE) \
+			|| HAS_EFFECT(EFFECT_S3M_MULTI_RETRIG_NOTE)
+		WRITE_U8(out + 0x47, ch->multi_retrig_ticks);
+		#endif
+		#if HAS_LOOPS
+		WRITE_U8(out + 0x48, ch->pattern_loop_origin);
+		WRITE_U8(out + 0x49, ch->pattern_loop_count);
+		#endif
+		#if HAS_EFFECT(EFFECT_SET_SAMPLE_OFFSET)
+		WRITE_U8(out + 0x4A, ch->sample_offset_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOLO)
+		WRITE_U8(out + 0x4B, ch->tremolo_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOLO) || HAS_EFFECT(EFFECT_S3M_TREMOLO)
+		WRITE_U8(out + 0x4C, ch->tremolo_ticks);
+		#endif
+		WRITE_U8(out + 0x4D, TREMOLO_CONTROL_PARAM(ch));
+		#if HAS_VIBRATO
+		WRITE_U8(out + 0x4E, ch->vibrato_param);
+		WRITE_U8(out + 0x4F, ch->vibrato_ticks);
+		#endif
+		WRITE_U8(out + 0x50, VIBRATO_OFFSET(ch));
+		WRITE_U8(out + 0x51, VIBRATO_CONTROL_PARAM(ch));
+		WRITE_U8(out + 0x52, AUTOVIBRATO_OFFSET(ch));
+		WRITE_U8(out + 0x53, ARP_NOTE_OFFSET(ch));
+		#if HAS_EFFECT(EFFECT_TREMOR)
+		WRITE_U8(out + 0x54, ch->tremor_param);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOR) || HAS_EFFECT(EFFECT_S3M_TREMOR)
+		WRITE_U8(out + 0x55, ch->tremor_ticks);
+		bool tremor_on = ch->tremor_on;
+		#else
+		bool tremor_on = false;
+		#endif
+		#if HAS_GLOBAL_EFFECT_MEMORY
+		WRITE_U8(out + 0x56, ch->effect_param);
+		#endif
+		#if HAS_ARPEGGIO_RESET
+		bool should_reset_arpeggio = ch->should_reset_arpeggio;
+		#else
+		bool should_reset_arpeggio = false;
+		#endif
+		WRITE_U8(out + 0x57, SAMPLE_OFFSET_INVALID(ch)
+		         | (SHOULD_RESET_VIBRATO(ch) << 1)
+		         | (should_reset_arpeggio << 2)
+		         | (tremor_on << 3)
+		         | (SUSTAINED(ch) << 4)
+		         | (CHANNEL_MUTED(ch) << 5));
+		out += STATE_CHANNEL_SZ;
+
+		#if XM_RAMPING
+		for(uint16_t j = 0; j < RAMPING_POINTS; ++j) {
+			WRITE_U32(out, F32_TO_U32(ch->end_of_previous_sample[j]));
+			out += 4;
+		}
+		#endif
+	}
+
+	for(uint8_t i = 0; i < NUM_INSTRUMENTS(&ctx->module); ++i) {
+		#if HAS_INSTRUMENTS && XM_TIMING_FUNCTIONS
+		WRITE_U32(out, ctx->instruments[i].latest_trigger);
+		#endif
+		#if HAS_INSTRUMENTS
+		WRITE_U8(out + 0x04, INSTRUMENT_MUTED(ctx->instruments + i));
+		#endif
+		out += STATE_INSTRUMENT_SZ;
+	}
+
+	for(uint16_t i = 0; i < ctx->module.num_samples; ++i) {
+		#if XM_TIMING_FUNCTIONS
+		WRITE_U32(out, ctx->samples[i].latest_trigger);
+		#endif
+		out += STATE_SAMPLE_SZ;
+	}
+
+	#if XM_LOOPING_TYPE == 2
+	__builtin_memcpy(out, ctx->row_loop_count,
+	                 xm_state_row_loop_counters(ctx));
+	#endif
+}
+
+/* Convert microsteps saved with another XM_MICROSTEP_BITS */
+static uint32_t xm_state_microsteps(uint32_t x, uint8_t bits) {
+	return bits > XM_MICROSTEP_BITS ? x >> (bits - XM_MICROSTEP_BITS)
+		: (uint32_t)((uint64_t)x << (XM_MICROSTEP_BITS - bits));
+}
+
+bool xm_load_state(xm_context_t* restrict ctx,
+                   const char* restrict moddata, uint32_t moddata_length) {
+	if(READ_U8(0x00) * 8 != STATE_HEADER_SZ || READ_U8(0x01) != 0
+	   || moddata_length < STATE_HEADER_SZ
+	   || __builtin_memcmp(moddata + 0x02, "LIBXMST\xFF", 8)) {
+		NOTICE("not a playback state, or unsupported version");
+		return false;
+	}
+
+	uint32_t row_loop_counters = READ_U32(0x10);
+	uint8_t microstep_bits = READ_U8(0x14);
+	uint8_t ramping_points = READ_U8(0x15);
+	if(READ_U8(0x0A) != NUM_CHANNELS(&ctx->module)
+	   || READ_U8(0x0B) != NUM_INSTRUMENTS(&ctx->module)
+	   || READ_U16(0x0C) != ctx->module.num_samples
+	   || READ_U16(0x0E) != ctx->module.length
+	   || (row_loop_counters != 0
+	       && row_loop_counters != xm_state_row_loop_counters(ctx))) {
+		NOTICE("playback state of another module");
+		return false;
+	}
+	if(microstep_bits > 31 || (ramping_points != 0
+	                           && ramping_points != RAMPING_POINTS)) {
+		NOTICE("invalid playback state");
+		return false;
+	}
+
+	uint64_t size = STATE_HEADER_SZ
+		+ NUM_CHANNELS(&ctx->module)
+		  * (STATE_CHANNEL_SZ + 4u * ramping_points)
+		+ NUM_INSTRUMENTS(&ctx->module) * STATE_INSTRUMENT_SZ
+		+ ctx->module.num_samples * STATE_SAMPLE_SZ
+		+ row_loop_counters;
+	uint16_t table_index = READ_U16(0x20);
+	uint16_t slots_pattern = READ_U16(0x22);
+	uint16_t slots_row = READ_U16(0x24);
+	if(size > moddata_length || table_index >= ctx->module.length
+	   || (slots_pattern != UINT16_MAX
+	       && (slots_pattern >= ctx->module.num_patterns
+	           || slots_row
+	              >= ctx->patterns[slots_pattern].num_rows))) {
+		NOTICE("invalid playback state");
+		return false;
+	}
+
+	/* Past the first tick, xm_tick_effects() reads the current slot of
+	   every channel, and xm_tick() divides by the BPM */
+	uint8_t tempo = READ_U8(0x2B);
+	if(((READ_U8(0x26) || READ_U8(0x29)) && slots_pattern == UINT16_MAX)
+	   || READ_U8(0x2A) > MAX_VOLUME
+	   || tempo >= MIN_BPM
+	   #if XM_LOOPING_TYPE != 1
+	   /* F00 is only kept (and stops playback) with XM_LOOPING_TYPE=1 */
+	   || tempo == 0
+	   #endif
+	   || READ_U8(0x2C) < MIN_BPM
+	   || READ_U8(0x2D) >= ctx->module.length) {
+		NOTICE("invalid playback state");
+		return false;
+	}
+
+	uint32_t offset = STATE_HEADER_SZ;
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		/* Pannings are a u8, always below MAX_PANNING */
+		static_assert(MAX_PANNING > UINT8_MAX);
+		if(READ_U8(offset) > NUM_INSTRUMENTS(&ctx->module)
+		   || READ_U16(offset + 0x02) > ctx->module.num_samples
+		   || READ_U8(offset + 0x32) > MAX_VOLUME) {
+			NOTICE("invalid playback state");
+			return false;
+		}
+		offset += STATE_CHANNEL_SZ + 4u * ramping_points;
+	}
+
+	/* Everything that can index memory has been checked, now actually
+	   load the state */
+	offset = STATE_HEADER_SZ;
+	uint16_t rate = READ_U16(0x16);
+	#if XM_SAMPLE_RATE == 0
+	ctx->current_sample_rate = rate;
+	#endif
+	ctx->remaining_samples_in_tick = READ_U32(0x18);
+	if(rate && rate != CURRENT_SAMPLE_RATE(ctx)) {
+		ctx->remaining_samples_in_tick = (uint32_t)
+			((uint64_t)ctx->remaining_samples_in_tick
+			 * CURRENT_SAMPLE_RATE(ctx) / rate);
+	}
+	#if XM_TIMING_FUNCTIONS
+	ctx->generated_samples = READ_U32(0x1C);
+	#endif
+	ctx->current_table_index = table_index;
+	#if XM_LOOPING_TYPE == 2
+	/* Cache of xm_row_loop_index(), consistent with xm_reset_context() */
+	ctx->row_loop_order = 0;
+	ctx->row_loop_index = 0;
+	#endif
+	ctx->current_tick = READ_U8(0x26);
+	ctx->current_row = READ_U8(0x27);
+	#if HAS_EFFECT(EFFECT_DELAY_PATTERN)
+	ctx->extra_rows_done = READ_U8(0x28);
+	ctx->extra_rows = READ_U8(0x29);
+	#endif
+	#if HAS_GLOBAL_VOLUME
+	ctx->global_volume = READ_U8(0x2A);
+	#endif
+	#if HAS_EFFECT(EFFECT_SET_TEMPO) && !HAS_HARDCODED_TEMPO
+	ctx->current_tempo = READ_U8(0x2B);
+	#endif
+	#if HAS_EFFECT(EFFECT_SET_BPM)
+	ctx->current_bpm = READ_U8(0x2C);
+	#endif
+	#if HAS_POSITION_JUMP
+	ctx->jump_dest = READ_U8(0x2D);
+	ctx->position_jump = READ_U8(0x30) & 2;
+	#endif
+	#if HAS_JUMP_ROW
+	ctx->jump_row = READ_U8(0x2E);
+	#endif
+	#if XM_LOOPING_TYPE == 2
+	ctx->loop_count = READ_U8(0x2F);
+	#endif
+	#if HAS_EFFECT(EFFECT_PATTERN_BREAK)
+	ctx->pattern_break = READ_U8(0x30) & 1;
+	#endif
+
+	#if XM_PACKED_PATTERNS
+	uint32_t packed_offset = 0;
+	ctx->next_packed_row = 0;
+	ctx->next_packed_offset = 0;
+	if(slots_pattern != UINT16_MAX) {
+		const xm_pattern_t* p = ctx->patterns + slots_pattern;
+		xm_pattern_slot_t skipped;
+		packed_offset = p->data_offset;
+		for(uint32_t i = slots_row * NUM_CHANNELS(&ctx->module);
+		    i; --i) {
+			packed_offset = xm_unpack_slot(ctx, packed_offset,
+			                               &skipped);
+		}
+	}
+	#endif
+
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		uint8_t flags = READ_U8(offset + 0x57);
+
+		#if HAS_INSTRUMENTS
+		ch->instrument = READ_U8(offset) ?
+			ctx->instruments + READ_U8(offset) - 1 : nullptr;
+		#endif
+		ch->next_instrument = READ_U8(offset + 0x01);
+		ch->sample = READ_U16(offset + 0x02) ?
+			ctx->samples + READ_U16(offset + 0x02) - 1 : nullptr;
+
+		if(slots_pattern == UINT16_MAX) {
+			ch->current = nullptr;
+		} else {
+			#if XM_PACKED_PATTERNS
+			packed_offset = xm_unpack_slot(ctx, packed_offset,
+			                               &ch->current_slot);
+			ch->current = &ch->current_slot;
+			#else
+			ch->current = ctx->pattern_slots
+				+ (ctx->patterns[slots_pattern].rows_index
+				   + slots_row) * NUM_CHANNELS(&ctx->module)
+				+ i;
+			#endif
+		}
+
+		#if XM_TIMING_FUNCTIONS
+		ch->latest_trigger = READ_U32(offset + 0x04);
+		#endif
+		ch->sample_position = xm_state_microsteps(
+			READ_U32(offset + 0x08), microstep_bits);
+		ch->step = xm_state_microsteps(READ_U32(offset + 0x0C),
+		                               microstep_bits);
+		ch->actual_volume[0] = U32_TO_F32(READ_U32(offset + 0x10));
+		ch->actual_volume[1] = U32_TO_F32(READ_U32(offset + 0x14));
+		#if XM_RAMPING
+		ch->target_volume[0] = U32_TO_F32(READ_U32(offset + 0x18));
+		ch->target_volume[1] = U32_TO_F32(READ_U32(offset + 0x1C));
+		ch->frame_count = READ_U32(offset + 0x20);
+		#endif
+		#if XM_ADPCM_SAMPLES
+		ch->adpcm_block[0] = 0;
+		ch->adpcm_block[1] = 0;
+		#endif
+		ch->period = READ_U16(offset + 0x24);
+		#if HAS_TONE_PORTAMENTO
+		ch->tone_portamento_target_period = READ_U16(offset + 0x26);
+		#endif
+		#if HAS_FADEOUT_VOLUME
+		ch->fadeout_volume = READ_U16(offset + 0x28);
+		#endif
+		#if HAS_FEATURE(FEATURE_AUTOVIBRATO)
+		ch->autovibrato_ticks = READ_U16(offset + 0x2A);
+		#endif
+		#if HAS_FEATURE(FEATURE_VOLUME_ENVELOPES)
+		ch->volume_envelope_frame_count = READ_U16(offset + 0x2C);
+		ch->volume_envelope_volume = READ_U8(offset + 0x30);
+		#endif
+		#if HAS_PANNING && HAS_FEATURE(FEATURE_PANNING_ENVELOPES)
+		ch->panning_envelope_frame_count = READ_U16(offset + 0x2E);
+		ch->panning_envelope_panning = READ_U8(offset + 0x31);
+		#endif
+		ch->volume = READ_U8(offset + 0x32);
+		#if HAS_VOLUME_OFFSET
+		ch->volume_offset = (int8_t)READ_U8(offset + 0x33);
+		#endif
+		#if HAS_PANNING
+		ch->panning = READ_U8(offset + 0x34);
+		#endif
+		#if HAS_PANNING && HAS_EFFECT(EFFECT_SET_CHANNEL_PANNING)
+		ch->base_panning = READ_U8(offset + 0x35);
+		#endif
+		ch->orig_note = READ_U8(offset + 0x36);
+		#if HAS_FINETUNES
+		ch->finetune = (int8_t)READ_U8(offset + 0x37);
+		#endif
+		#if HAS_VOLUME_SLIDE
+		ch->volume_slide_param = READ_U8(offset + 0x38);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_VOLUME_SLIDE_UP)
+		ch->fine_volume_slide_up_param = READ_U8(offset + 0x39);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_VOLUME_SLIDE_DOWN)
+		ch->fine_volume_slide_down_param = READ_U8(offset + 0x3A);
+		#endif
+		#if HAS_EFFECT(EFFECT_GLOBAL_VOLUME_SLIDE)
+		ch->global_volume_slide_param = READ_U8(offset + 0x3B);
+		#endif
+		#if HAS_PANNING && HAS_EFFECT(EFFECT_PANNING_SLIDE)
+		ch->panning_slide_param = READ_U8(offset + 0x3C);
+		#endif
+		#if HAS_EFFECT(EFFECT_PORTAMENTO_UP)
+		ch->portamento_up_param = READ_U8(offset + 0x3D);
+		#endif
+		#if HAS_EFFECT(EFFECT_PORTAMENTO_DOWN)
+		ch->portamento_down_param = READ_U8(offset + 0x3E);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_PORTAMENTO_UP)
+		ch->fine_portamento_up_param = READ_U8(offset + 0x3F);
+		#endif
+		#if HAS_EFFECT(EFFECT_FINE_PORTAMENTO_DOWN)
+		ch->fine_portamento_down_param = READ_U8(offset + 0x40);
+		#endif
+		#if HAS_EFFECT(EFFECT_EXTRA_FINE_PORTAMENTO_UP)
+		ch->extra_fine_portamento_up_param = READ_U8(offset + 0x41);
+		#endif
+		#if HAS_EFFECT(EFFECT_EXTRA_FINE_PORTAMENTO_DOWN)
+		ch->extra_fine_portamento_down_param = READ_U8(offset + 0x42);
+		#endif
+		#if HAS_GLISSANDO_CONTROL
+		ch->glissando_control_param = READ_U8(offset + 0x43);
+		ch->glissando_control_error = (int8_t)READ_U8(offset + 0x44);
+		#endif
+		#if HAS_TONE_PORTAMENTO
+		ch->tone_portamento_param = READ_U8(offset + 0x45);
+		#endif
+		#if HAS_EFFECT(EFFECT_MULTI_RETRIG_NOTE)
+		ch->multi_retrig_param = READ_U8(offset + 0x46);
+		#endif
+		#if HAS_EFFECT(EFFECT_MULTI_RETRIG_NOTE) \
+			|| HAS_EFFECT(EFFECT_S3M_MULTI_RETRIG_NOTE)
+		ch->multi_retrig_ticks = READ_U8(offset + 0x47);
+		#endif
+		#if HAS_LOOPS
+		ch->pattern_loop_origin = READ_U8(offset + 0x48);
+		ch->pattern_loop_count = READ_U8(offset + 0x49);
+		#endif
+		#if HAS_EFFECT(EFFECT_SET_SAMPLE_OFFSET)
+		ch->sample_offset_param = READ_U8(offset + 0x4A);
+		#endif
+		#if HAS_SAMPLE_OFFSET_INVALID
+		ch->sample_offset_invalid = flags & 1;
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOLO)
+		ch->tremolo_param = READ_U8(offset + 0x4B);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOLO) || HAS_EFFECT(EFFECT_S3M_TREMOLO)
+		ch->tremolo_ticks = READ_U8(offset + 0x4C);
+		#endif
+		#if (HAS_EFFECT(EFFECT_TREMOLO) || HAS_EFFECT(EFFECT_S3M_TREMOLO)) \
+			&& HAS_EFFECT(EFFECT_SET_TREMOLO_CONTROL)
+		ch->tremolo_control_param = READ_U8(offset + 0x4D);
+		#endif
+		#if HAS_VIBRATO
+		ch->vibrato_param = READ_U8(offset + 0x4E);
+		ch->vibrato_ticks = READ_U8(offset + 0x4F);
+		ch->vibrato_offset = (int8_t)READ_U8(offset + 0x50);
+		#endif
+		#if HAS_VIBRATO_RESET
+		ch->should_reset_vibrato = flags & 2;
+		#endif
+		#if HAS_VIBRATO && HAS_EFFECT(EFFECT_SET_VIBRATO_CONTROL)
+		ch->vibrato_control_param = READ_U8(offset + 0x51);
+		#endif
+		#if HAS_FEATURE(FEATURE_AUTOVIBRATO)
+		ch->autovibrato_offset = (int8_t)READ_U8(offset + 0x52);
+		#endif
+		#if HAS_ARPEGGIO_RESET
+		ch->should_reset_arpeggio = flags & 4;
+		#endif
+		#if HAS_ARPEGGIO
+		ch->arp_note_offset = READ_U8(offset + 0x53);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOR)
+		ch->tremor_param = READ_U8(offset + 0x54);
+		#endif
+		#if HAS_EFFECT(EFFECT_TREMOR) || HAS_EFFECT(EFFECT_S3M_TREMOR)
+		ch->tremor_ticks = READ_U8(offset + 0x55);
+		ch->tremor_on = flags & 8;
+		#endif
+		#if HAS_GLOBAL_EFFECT_MEMORY
+		ch->effect_param = READ_U8(offset + 0x56);
+		#endif
+		#if HAS_SUSTAIN
+		ch->sustained = flags & 16;
+		#endif
+		#if XM_MUTING_FUNCTIONS
+		ch->muted = flags & 32;
+		#endif
+		offset += STATE_CHANNEL_SZ;
+
+		#if XM_RAMPING
+		for(uint16_t j = 0; j < RAMPING_POINTS; ++j) {
+			ch->end_of_previous_sample[j] = ramping_points ?
+				U32_TO_F32(READ_U32(offset + 4u * j)) : 0.f;
+		}
+		#endif
+		offset += 4u * ramping_points;
+	}
+
+	#if XM_PACKED_PATTERNS
+	if(slots_pattern != UINT16_MAX) {
+		ctx->next_packed_row = ctx->patterns[slots_pattern].rows_index
+			+ slots_row + 1u;
+		ctx->next_packed_offset = packed_offset;
+	}
+	#endif
+
+	for(uint8_t i = 0; i < NUM_INSTRUMENTS(&ctx->module); ++i) {
+		#if HAS_INSTRUMENTS && XM_TIMING_FUNCTIONS
+		ctx->instruments[i].latest_trigger = READ_U32(offset);
+		#endif
+		#if HAS_INSTRUMENTS && XM_MUTING_FUNCTIONS
+		ctx->instruments[i].muted = READ_U8(offset + 0x04);
+		#endif
+		offset += STATE_INSTRUMENT_SZ;
+	}
+
+	for(uint16_t i = 0; i < ctx->module.num_samples; ++i) {
+		#if XM_TIMING_FUNCTIONS
+		ctx->samples[i].latest_trigger = READ_U32(offset);
+		#endif
+		offset += STATE_SAMPLE_SZ;
+	}
+
+	#if XM_LOOPING_TYPE == 2
+	if(row_loop_counters) {
+		__builtin_memcpy(ctx->row_loop_count, moddata + offset,
+		                 row_loop_counters);
+	} else {
+		__builtin_memset(ctx->row_loop_count, 0,
+		                 xm_state_row_loop_counters(ctx));
+	}
+	#endif
+
+	return true;
+}
+
 /* ----- Fasttracker II .XM (XM 0104): little endian ----- */
 
 static bool xm_prescan_xm0104(const char* restrict moddata,
@@ -1009,9 +2465,15 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 	out->num_rows = 0;
 	out->samples_data_length = 0;
 
+	uint16_t pattern_rows[MAX_PATTERNS];
 	uint8_t pot[PATTERN_ORDER_TABLE_LENGTH];
 	READ_MEMCPY(pot, offset + 20, PATTERN_ORDER_TABLE_LENGTH);
 
+	#if XM_DEDUPLICATE
+	xm_dedup_t dedup;
+	dedup.count = 0;
+	#endif
+
 	/* Header size */
 	offset += READ_U32(offset);
 
@@ -1031,6 +2493,16 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 			       i, num_rows, MAX_ROWS_PER_PATTERN);
 			return false;
 		}
+		pattern_rows[i] = num_rows;
+
+		#if XM_DEDUPLICATE
+		if(xm_dedup(&dedup, moddata, moddata_length,
+		            offset + READ_U32(offset), packed_size,
+		            num_rows, i) != i) {
+			/* Will share the rows of an identical pattern */
+			num_rows = 0;
+		}
+		#endif
 
 		out->num_rows += num_rows;
 
@@ -1042,6 +2514,11 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 	if(out->pot_length > PATTERN_ORDER_TABLE_LENGTH) {
 		out->pot_length = PATTERN_ORDER_TABLE_LENGTH;
 	}
+	out->pot_rows = 0;
+	for(uint16_t i = 0; i < out->pot_length; ++i) {
+		out->pot_rows += (pot[i] < out->num_patterns) ?
+			pattern_rows[pot[i]] : EMPTY_PATTERN_NUM_ROWS;
+	}
 	for(uint16_t i = 0; i < out->pot_length; ++i) {
 		if(pot[i] >= out->num_patterns) {
 			if(out->num_patterns >= MAX_PATTERNS) {
@@ -1059,6 +2536,12 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 		}
 	}
 
+	#if XM_DEDUPLICATE
+	if(dedup.count != DEDUP_DISABLED) {
+		dedup.count = 0;
+	}
+	#endif
+
 	/* Read instrument headers */
 	for(uint16_t i = 0; i < out->num_instruments; ++i) {
 		uint16_t num_samples = READ_U16(offset + 27);
@@ -1082,6 +2565,8 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 
 		/* Instrument header size */
 		offset += READ_U32(offset);
+		[[maybe_unused]] uint32_t data_offset =
+			offset + SAMPLE_HEADER_SIZE * num_samples;
 
 		/* Read sample headers */
 		for(uint16_t j = 0; j < num_samples; ++j) {
@@ -1109,9 +2594,46 @@ static bool xm_prescan_xm0104(const char* restrict moddata,
 				return false;
 			}
 
+			uint32_t unrolled_length = 0;
+			#if UNROLL_PING_PONG
+			/* Same as xm_load_xm0104_sample_header() */
+			if((flags & SAMPLE_FLAG_PING_PONG)
+			   && loop_start + loop_length <= sample_bytes) {
+				unrolled_length = (flags & SAMPLE_FLAG_16B) ?
+					loop_length / 2 : loop_length;
+			}
+			#endif
+
 			if(HAS_FEATURE(FEATURE_MULTISAMPLE_INSTRUMENTS)
 			   || j == 0) {
-				out->samples_data_length += sample_length;
+				#if XM_DEDUPLICATE
+				if((flags & SAMPLE_FLAG_16B)
+				   && sample_bytes % 2) {
+					/* The loader advances by whole
+					   frames (dropping the odd byte),
+					   this advances by the raw byte
+					   count: offsets disagree from
+					   here on */
+					dedup.count = DEDUP_DISABLED;
+				}
+				uint32_t key = sample_length
+					| ((flags & SAMPLE_FLAG_16B) ?
+					   (1u << 31) : 0);
+				if(unrolled_length == 0
+				   && xm_dedup(&dedup, moddata, moddata_length,
+				               data_offset + inst_samples_bytes,
+				               (flags & SAMPLE_FLAG_16B) ?
+				               sample_length * 2 : sample_length,
+				               key, out->samples_data_length)
+				   != out->samples_data_length) {
+					/* Will share the data of an identical
+					   sample */
+					sample_length = 0;
+				}
+				#endif
+				sample_length += unrolled_length;
+				out->samples_data_length +=
+					SAMPLE_DATA_LENGTH(sample_length);
 			}
 
 			inst_samples_bytes += sample_bytes;
@@ -1217,6 +2739,7 @@ static uint32_t xm_load_xm0104_module_header(xm_context_t* ctx,
 
 static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
                                        xm_pattern_t* pat,
+                                       [[maybe_unused]] xm_dedup_t* dedup,
                                        const char* moddata,
                                        uint32_t moddata_length,
                                        uint32_t offset) {
@@ -1237,6 +2760,20 @@ static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
 	/* Pattern header length */
 	offset += READ_U32(offset);
 
+	#if XM_DEDUPLICATE
+	uint16_t i = (uint16_t)(pat - ctx->patterns);
+	uint16_t shared = (uint16_t)xm_dedup(dedup, moddata, moddata_length,
+	                                     offset, packed_patterndata_size,
+	                                     packed_patterndata_size ?
+	                                     pat->num_rows :
+	                                     EMPTY_PATTERN_NUM_ROWS, i);
+	if(shared != i) {
+		ctx->module.num_rows -= pat->num_rows;
+		*pat = ctx->patterns[shared];
+		return offset + packed_patterndata_size;
+	}
+	#endif
+
 	if(packed_patterndata_size == 0) {
 		/* Assume empty pattern */
 		ctx->module.num_rows -= pat->num_rows;
@@ -1386,6 +2923,8 @@ static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
 
 static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
                                           [[maybe_unused]] xm_instrument_t* instr,
+                                          xm_sample_data_job_t* job,
+                                          [[maybe_unused]] xm_dedup_t* dedup,
                                           const char* moddata,
                                           uint32_t moddata_length,
                                           uint32_t offset) {
@@ -1488,7 +3027,7 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 
 	/* Read sample headers */
 	uint16_t samples_index = ctx->module.num_samples;
-	[[maybe_unused]] uint32_t extra_samples_size = 0;
+	uint32_t extra_samples_size = 0;
 
 	#if HAS_FEATURE(FEATURE_MULTISAMPLE_INSTRUMENTS)
 	ctx->module.num_samples += num_samples;
@@ -1496,6 +3035,7 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 	ctx->module.num_samples += 1;
 	#endif
 
+	uint32_t headers = offset;
 	for(uint16_t i = 0; i < num_samples; ++i) {
 		if(HAS_FEATURE(FEATURE_MULTISAMPLE_INSTRUMENTS) || i == 0) {
 			bool is_16bit;
@@ -1513,41 +3053,121 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 		}
 	}
 
-	/* Read sample data */
-	for(uint16_t i = 0; i < num_samples; ++i) {
+	/* Assign sample data indexes and skip sample data, then either decode
+	   it now or leave it to the caller */
+	xm_sample_data_job_t j = {
+		.offset = offset,
+		.headers = headers,
+		.first_sample = samples_index,
+		#if HAS_FEATURE(FEATURE_MULTISAMPLE_INSTRUMENTS)
+		.num_samples = num_samples,
+		#else
+		.num_samples = 1,
+		#endif
+	};
+	for(uint16_t i = 0; i < j.num_samples; ++i) {
 		xm_sample_t* s = ctx->samples + samples_index + i;
 		/* As currently loaded, s->index is the real sample length in
 		   the xm file, s->length is after trimming to loop_end (and the
 		   actual sample length as stored in the context) */
-		xm_sample_point_t* sample_data = ctx->samples_data
-			+ ctx->module.samples_data_length;
-		if(s->length & (1u << 31)) {
-			s->length &= ~(1u << 31);
+		bool is_16bit = s->length & (1u << 31);
+		uint32_t length = s->length & ~(1u << 31);
+		uint32_t index = ctx->module.samples_data_length;
+		/* Unrolled after decoding, see xm_load_xm0104_sample_data() */
+		uint32_t unrolled_length = (UNROLL_PING_PONG && PING_PONG(s)) ?
+			s->loop_length : 0;
+
+		#if XM_DEDUPLICATE
+		if(is_16bit && READ_U32(headers + SAMPLE_HEADER_SIZE * i) % 2) {
+			/* Same as xm_prescan_xm0104() */
+			dedup->count = DEDUP_DISABLED;
+		}
+		if(unrolled_length == 0) {
+			index = xm_dedup(dedup, moddata, moddata_length, offset,
+			                 is_16bit ? length * 2 : length,
+			                 s->length, index);
+		}
+		if(index != ctx->module.samples_data_length) {
+			/* Share the data of an identical sample, mark it
+			   to not be decoded */
+			static_assert(MAX_SAMPLE_LENGTH < (1u << 30));
+			s->length |= (1u << 30);
+			length = 0;
+		}
+		#endif
+
+		offset += is_16bit ? s->index * 2 : s->index;
+		s->index = index;
+		ctx->module.samples_data_length +=
+			SAMPLE_DATA_LENGTH(length + unrolled_length);
+	}
+	offset += extra_samples_size;
+
+	if(job) {
+		*job = j;
+	} else {
+		xm_load_xm0104_sample_data(ctx, &j, moddata, moddata_length);
+	}
+
+	return offset;
+}
+
+static void xm_load_xm0104_sample_data(xm_context_t* ctx,
+                                       const xm_sample_data_job_t* job,
+                                       const char* moddata,
+                                       uint32_t moddata_length) {
+	uint32_t offset = job->offset;
+	for(uint16_t i = 0; i < job->num_samples; ++i) {
+		xm_sample_t* s = ctx->samples + job->first_sample + i;
+		uint32_t bytes = READ_U32(job->headers + SAMPLE_HEADER_SIZE * i);
+		bool is_16bit = s->length & (1u << 31);
+		bool is_shared = s->length & (1u << 30);
+		s->length &= ~((1u << 31) | (1u << 30));
+
+		if(is_16bit) {
+			/* Only advance by whole frames: an odd byte is
+			   not skipped, and is read as the first
+			   byte of the next sample */
+			bytes &= ~1u;
 			if(_Generic((xm_sample_point_t){},
 			            int8_t: true,
 			            default: false)) {
 				NOTICE("16 bit sample will be dithered to 8 bits");
 			}
-			xm_load_xm0104_16b_sample_data(s->length, sample_data,
+		}
+
+		uint32_t unrolled_length = (UNROLL_PING_PONG && PING_PONG(s)) ?
+			s->loop_length : 0;
+		if(is_shared) {
+			/* Already decoded by an identical sample */
+		} else if(is_16bit) {
+			xm_load_xm0104_16b_sample_data(ctx, s->index, s->length,
+			                               unrolled_length,
 			                               moddata, moddata_length,
 			                               offset);
-			offset += s->index * 2;
 		} else {
-			xm_load_xm0104_8b_sample_data(s->length, sample_data,
+			xm_load_xm0104_8b_sample_data(ctx, s->index, s->length,
+			                              unrolled_length,
 			                              moddata, moddata_length,
 			                              offset);
-			offset += s->index;
 		}
-		s->index = ctx->module.samples_data_length;
-		ctx->module.samples_data_length += s->length;
-
-		#if !HAS_FEATURE(FEATURE_MULTISAMPLE_INSTRUMENTS)
-		offset += extra_samples_size;
-		break;
+		#if UNROLL_PING_PONG
+		if(unrolled_length) {
+			/* Now a forward loop over the ping-pong loop and its
+			   reverse */
+			s->length += unrolled_length;
+			s->loop_length *= 2;
+			s->ping_pong = false;
+		}
 		#endif
+		offset += bytes;
 	}
+}
 
-	return offset;
+static void xm_load_xm0104_sample_data_task(void* data, uint32_t i) {
+	xm_sample_data_tasks_t* tasks = data;
+	xm_load_xm0104_sample_data(tasks->ctx, tasks->jobs + i,
+	                           tasks->moddata, tasks->moddata_length);
 }
 
 static void xm_load_xm0104_envelope_points(xm_envelope_t* env,
@@ -1710,33 +3330,83 @@ static uint32_t xm_load_xm0104_sample_header(xm_sample_t* sample, bool* is_16bit
 	return offset + SAMPLE_HEADER_SIZE;
 }
 
-static void xm_load_xm0104_8b_sample_data(uint32_t length,
-                                          xm_sample_point_t* out,
+/* The last unrolled_length frames are stored again in reverse order after
+   the sample, the deltas are undone to walk backwards */
+static void xm_load_xm0104_8b_sample_data(xm_context_t* ctx,
+                                          uint32_t idx,
+                                          uint32_t length,
+                                          uint32_t unrolled_length,
                                           const char* moddata,
                                           uint32_t moddata_length,
                                           uint32_t offset) {
 	int8_t v = 0;
 	uint8_t s;
-	for(uint32_t k = 0; k < length; ++k) {
+	uint32_t k = 0;
+	#if SAMPLE_VECTORS
+	/* Whole blocks that can be read without bounds checks */
+	uint32_t avail = offset < moddata_length ? moddata_length - offset : 0;
+	for(; k + 16 <= length && k + 16 <= avail; k += 16) {
+		xm_s8x16_t x;
+		__builtin_memcpy(&x, moddata + offset + k, sizeof(x));
+		x = xm_prefix_sum_s8x16(x, v);
+		v = x[15];
+		for(uint8_t j = 0; j < 16; ++j) {
+			xm_store_sample_point(ctx, idx + k + j,
+			                      SAMPLE_POINT_FROM_S8(x[j]));
+		}
+	}
+	#endif
+	for(; k < length; ++k) {
 		s = READ_U8(offset + k);
 		v += (int8_t)s;
-		out[k] = SAMPLE_POINT_FROM_S8(v);
+		xm_store_sample_point(ctx, idx + k, SAMPLE_POINT_FROM_S8(v));
+	}
+	for(uint32_t r = 0; r < unrolled_length; ++r) {
+		xm_store_sample_point(ctx, idx + length + r,
+		                      SAMPLE_POINT_FROM_S8(v));
+		v = (int8_t)(v - (int8_t)READ_U8(offset + length - 1 - r));
 	}
 }
 
-static void xm_load_xm0104_16b_sample_data(uint32_t length,
-                                           xm_sample_point_t* out,
+/* Same as xm_load_xm0104_8b_sample_data() */
+static void xm_load_xm0104_16b_sample_data(xm_context_t* ctx,
+                                           uint32_t idx,
+                                           uint32_t length,
+                                           uint32_t unrolled_length,
                                            const char* moddata,
                                            uint32_t moddata_length,
                                            uint32_t offset) {
 	int16_t v = 0;
-	for(uint32_t k = 0; k < length; ++k) {
+	uint32_t k = 0;
+	#if SAMPLE_VECTORS
+	/* Whole blocks that can be read without bounds checks */
+	uint32_t avail = offset < moddata_length ?
+		(moddata_length - offset) / 2 : 0;
+	for(; k + 8 <= length && k + 8 <= avail; k += 8) {
+		xm_s16x8_t x = xm_prefix_sum_s16x8(
+			xm_load_s16x8_le(moddata + offset + (k << 1)), v);
+		v = x[7];
+		xm_sample_point_x8_t y = SAMPLE_POINTS_FROM_S16X8(x, idx + k);
+		for(uint8_t j = 0; j < 8; ++j) {
+			xm_store_sample_point(ctx, idx + k + j, y[j]);
+		}
+	}
+	#endif
+	for(; k < length; ++k) {
 		v += (int16_t)READ_U16(offset + (k << 1));
-		out[k] = SAMPLE_POINT_FROM_S16(v);
+		xm_store_sample_point(ctx, idx + k,
+		                      SAMPLE_POINT_FROM_S16(v, idx + k));
+	}
+	for(uint32_t r = 0; r < unrolled_length; ++r) {
+		xm_store_sample_point(ctx, idx + length + r,
+		                      SAMPLE_POINT_FROM_S16(v, idx + length + r));
+		v -= (int16_t)READ_U16(offset + ((length - 1 - r) << 1));
 	}
 }
 
-static void xm_load_xm0104(xm_context_t* ctx,
+/* If jobs is not NULL, sample data is not decoded. Instead, jobs[i] is filled
+   in with what to decode for instrument i. */
+static void xm_load_xm0104(xm_context_t* ctx, xm_sample_data_job_t* jobs,
                            const char* moddata, uint32_t moddata_length) {
 	/* Read module header */
 	uint8_t num_instruments;
@@ -1748,9 +3418,16 @@ static void xm_load_xm0104(xm_context_t* ctx,
 	                 NUM_CHANNELS(&ctx->module));
 	#endif
 
+	xm_dedup_t* dedup = nullptr;
+	#if XM_DEDUPLICATE
+	xm_dedup_t d;
+	d.count = 0;
+	dedup = &d;
+	#endif
+
 	/* Read pattern headers + slots */
 	for(uint16_t i = 0; i < ctx->module.num_patterns; ++i) {
-		offset = xm_load_xm0104_pattern(ctx, ctx->patterns + i,
+		offset = xm_load_xm0104_pattern(ctx, ctx->patterns + i, dedup,
 		                                moddata, moddata_length, offset);
 	}
 
@@ -1781,6 +3458,12 @@ static void xm_load_xm0104(xm_context_t* ctx,
 		ctx->module.num_rows += EMPTY_PATTERN_NUM_ROWS;
 	}
 
+	#if XM_DEDUPLICATE
+	if(d.count != DEDUP_DISABLED) {
+		d.count = 0;
+	}
+	#endif
+
 	/* Read instruments, samples and sample data */
 	for(uint16_t i = 0; i < num_instruments; ++i) {
 		xm_instrument_t* inst;
@@ -1791,6 +3474,8 @@ static void xm_load_xm0104(xm_context_t* ctx,
 		#endif
 
 		offset = xm_load_xm0104_instrument(ctx, inst,
+		                                   jobs ? jobs + i : nullptr,
+		                                   dedup,
 		                                   moddata, moddata_length,
 		                                   offset);
 	}
@@ -1817,10 +3502,14 @@ static bool xm_prescan_mod(const char* restrict moddata,
 			                            loop_length,
 			                            SAMPLE_FLAG_FORWARD);
 		}
-		p->samples_data_length += length;
+		p->samples_data_length += SAMPLE_DATA_LENGTH(length);
 	}
 
 	p->pot_length = READ_U8(950);
+	if(p->pot_length > 128) {
+		/* Same as xm_load_mod() */
+		p->pot_length = 128;
+	}
 	p->num_patterns = 0;
 	for(uint8_t i = 0; i < 128; ++i) {
 		uint8_t pval = READ_U8(952 + i);
@@ -1833,6 +3522,7 @@ static bool xm_prescan_mod(const char* restrict moddata,
 		p->num_patterns /= 2;
 	}
 	p->num_rows = (uint32_t)(64u * p->num_patterns);
+	p->pot_rows = 64u * p->pot_length;
 
 	/* Pattern data may be truncated */
 	uint32_t min_sz = (uint32_t)(1084u + p->samples_data_length);
@@ -2058,14 +3748,15 @@ static void xm_load_mod(xm_context_t* restrict ctx,
 
 	/* Read sample data */
 	for(uint8_t i = 0; i < ctx->module.num_samples; ++i) {
-		xm_sample_point_t* out = ctx->samples_data
-			+ ctx->module.samples_data_length;
+		uint32_t idx = ctx->module.samples_data_length;
 		for(uint32_t k = 0; k < ctx->samples[i].length; ++k) {
-			*out++ = SAMPLE_POINT_FROM_S8((int8_t)READ_U8(offset+k));
+			xm_store_sample_point(ctx, idx + k, SAMPLE_POINT_FROM_S8(
+				                      (int8_t)READ_U8(offset+k)));
 		}
 		offset += ctx->samples[i].index;
 		ctx->samples[i].index = ctx->module.samples_data_length;
-		ctx->module.samples_data_length += ctx->samples[i].length;
+		ctx->module.samples_data_length +=
+			SAMPLE_DATA_LENGTH(ctx->samples[i].length);
 	}
 }
 
@@ -2282,6 +3973,7 @@ static bool xm_prescan_s3m(const char* restrict moddata,
 
 	out->num_instruments = (uint8_t)out->num_samples;
 	out->num_rows = out->num_patterns * 64;
+	out->pot_rows = out->pot_length * 64u;
 
 	uint16_t used_channels = 0; /* bit field */
 	for(uint8_t ch = 0; ch < 32; ++ ch) {
@@ -2319,7 +4011,7 @@ static bool xm_prescan_s3m(const char* restrict moddata,
 			       i, length, MAX_SAMPLE_LENGTH);
 			return false;
 		}
-		out->samples_data_length += length;
+		out->samples_data_length += SAMPLE_DATA_LENGTH(length);
 	}
 
 	return true;
@@ -2600,26 +4292,44 @@ void xm_load_s3m_instrument(xm_context_t* restrict ctx,
 
 	/* Now read sample data */
 	smp->index = ctx->module.samples_data_length;
-	xm_sample_point_t* out = ctx->samples_data
-		+ ctx->module.samples_data_length;
 	offset = 16 * ((((uint32_t)READ_U8(offset + 13)) << 16)
 	               + READ_U16(offset + 14));
 	if(is_16bit) {
 		smp->length /= 2;
 		smp->loop_length /= 2;
 	}
-	for(uint32_t k = 0; k < smp->length; ++k) {
-		*out++ = is_16bit
+	uint32_t k = 0;
+	#if SAMPLE_VECTORS
+	/* Whole blocks of 16-bit data that can be read without bounds
+	   checks */
+	uint32_t avail = (is_16bit && offset < moddata_length) ?
+		(moddata_length - offset) / 2 : 0;
+	for(; k + 8 <= smp->length && k + 8 <= avail; k += 8) {
+		xm_s16x8_t x = xm_load_s16x8_le(moddata + offset + 2*k);
+		if(!signed_smp_data) {
+			x = (xm_s16x8_t)((xm_u16x8_t)x ^ (uint16_t)INT16_MIN);
+		}
+		xm_sample_point_x8_t y = SAMPLE_POINTS_FROM_S16X8(x,
+		                                                  smp->index
+		                                                  + k);
+		for(uint8_t j = 0; j < 8; ++j) {
+			xm_store_sample_point(ctx, smp->index + k + j, y[j]);
+		}
+	}
+	#endif
+	for(; k < smp->length; ++k) {
+		xm_store_sample_point(ctx, smp->index + k, is_16bit
 			? SAMPLE_POINT_FROM_S16((int16_t)
 			                        (READ_U16(offset + 2*k)
 			                         + (signed_smp_data
-			                            ? 0 : INT16_MIN)))
+			                            ? 0 : INT16_MIN)),
+			                        smp->index + k)
 			: SAMPLE_POINT_FROM_S8((int8_t)
 			                       (READ_U8(offset + k)
 			                        + (signed_smp_data
-			                           ? 0 : INT8_MIN)));
+			                           ? 0 : INT8_MIN))));
 	}
-	ctx->module.samples_data_length += smp->length;
+	ctx->module.samples_data_length += SAMPLE_DATA_LENGTH(smp->length);
 }
 
 static void xm_load_s3m_pattern(xm_context_t* restrict ctx,
@@ -57,7 +57,11 @@ static void xm_tick_effects(xm_context_t*, xm_channel_context_t*) __attribute__(
 [[maybe_unused]] static uint8_t xm_envelope_lerp(const xm_envelope_point_t* restrict, const xm_envelope_point_t* restrict, uint16_t) __attribute__((warn_unused_result)) __attribute__((nonnull))  __attribute__((const));
 [[maybe_unused]] static uint8_t xm_tick_envelope(xm_channel_context_t*, const xm_envelope_t*, uint16_t*) __attribute__((nonnull)) __attribute__((warn_unused_result));
 
-static void xm_tick_envelopes(xm_channel_context_t*) __attribute__((nonnull));
+static void xm_tick_envelopes(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
+static bool xm_tick_voice(xm_context_t*, xm_channel_context_t*, uint16_t) __attribute__((nonnull));
+#if XM_SFX_VOICES
+static bool xm_sfx_voice_done(const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+#endif
 
 static uint16_t xm_linear_period(int16_t) __attribute__((warn_unused_result)) __attribute__((const));
 static uint16_t xm_amiga_period(int16_t) __attribute__((warn_unused_result)) __attribute__((const));
@@ -80,12 +84,57 @@ static void xm_cut_note(xm_channel_context_t*) __attribute__((nonnull));
 static void xm_key_off(xm_channel_context_t*) __attribute__((nonnull));
 
 static void xm_row(xm_context_t*) __attribute__((nonnull));
+#if XM_TRANSITIONS
+static bool xm_transition_due(const xm_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_transition(xm_context_t*) __attribute__((nonnull));
+static void xm_crossfade(xm_context_t*, float*, float*) __attribute__((nonnull));
+#endif
 
-static float xm_sample_at(const xm_context_t*, const xm_sample_t*, uint32_t) __attribute__((warn_unused_result)) __attribute__((nonnull)) __attribute__((const));
+static float xm_sample_at(const xm_context_t*, xm_channel_context_t*, uint32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
 static float xm_next_of_sample(xm_context_t*, xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static bool xm_wrap_sample_position(xm_channel_context_t*) __attribute__((nonnull));
 static void xm_next_of_channel(xm_context_t*, xm_channel_context_t*, float*, float*) __attribute__((nonnull));
+static bool xm_channel_silenced(const xm_context_t*, const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+#if XM_RAMPING
+static void xm_ramp_channel(xm_channel_context_t*) __attribute__((nonnull));
+#endif
+static void xm_skip_of_channel(const xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
+static void xm_skip_sample(xm_context_t*) __attribute__((nonnull));
 static void xm_sample_unmixed(xm_context_t*, float*) __attribute__((nonnull));
 static void xm_sample(xm_context_t*, float*, float*) __attribute__((nonnull));
+static void xm_finish_sample(xm_context_t*, float*, float*) __attribute__((nonnull));
+#if XM_PROFILING
+static void xm_profile_render(xm_context_t*, uint64_t, uint64_t, uint16_t) __attribute__((nonnull));
+#endif
+
+struct xm_batch_s {
+	xm_context_t* const* ctxs;
+	float* const* outputs;
+	uint16_t numsamples;
+	char __pad[6];
+};
+typedef struct xm_batch_s xm_batch_t;
+static void xm_generate_samples_batch_task(void*, uint32_t) __attribute__((nonnull));
+
+#if XM_PARALLEL_MIXING
+/* Channels are mixed in groups, each group by one task into its own
+   accumulator. Summing accumulators rounds differently than summing channels
+   one by one, so only modules with up to MIX_GROUP_CHANNELS channels sound
+   exactly the same as with xm_generate_samples(). */
+#define MIX_GROUP_CHANNELS 4
+#define NUM_MIX_GROUPS(mod) (((uint32_t)NUM_CHANNELS(mod) \
+                              + MIX_GROUP_CHANNELS - 1) / MIX_GROUP_CHANNELS)
+
+struct xm_mix_tasks_s {
+	xm_context_t* ctx;
+	float* accumulators; /* stride floats per group */
+	uint32_t stride;
+	uint16_t numsamples; /* Frames to mix, all within the same tick */
+	char __pad[2];
+};
+typedef struct xm_mix_tasks_s xm_mix_tasks_t;
+static void xm_mix_channel_group(void*, uint32_t) __attribute__((nonnull));
+#endif
 
 /* ----- Other oddities ----- */
 
@@ -799,12 +848,16 @@ static void xm_handle_pattern_slot(xm_context_t* ctx, xm_channel_context_t* ch)
 	#if HAS_EFFECT(EFFECT_SET_TEMPO)
 	case EFFECT_SET_TEMPO:
 		ctx->current_tempo = s->effect_param;
+		TRACE(ctx, XM_TRACE_SPEED, (uint8_t)(ch - ctx->channels + 1),
+		      CURRENT_TEMPO(ctx), CURRENT_BPM(ctx), 0);
 		break;
 	#endif
 
 	#if HAS_EFFECT(EFFECT_SET_BPM)
 	case EFFECT_SET_BPM:
 		ctx->current_bpm = s->effect_param;
+		TRACE(ctx, XM_TRACE_SPEED, (uint8_t)(ch - ctx->channels + 1),
+		      CURRENT_TEMPO(ctx), CURRENT_BPM(ctx), 0);
 		break;
 	#endif
 
@@ -1038,6 +1091,7 @@ static void xm_trigger_instrument([[maybe_unused]] xm_context_t* ctx,
 }
 
 static void xm_trigger_note(xm_context_t* ctx, xm_channel_context_t* ch) {
+	PROFILE(ctx, XM_PROFILE_TRIGGER_NOTE);
 	#if XM_RAMPING
 	if(ch->sample && ch->period) {
 		static_assert(RAMPING_POINTS <= UINT8_MAX);
@@ -1167,6 +1221,17 @@ static void xm_trigger_note(xm_context_t* ctx, xm_channel_context_t* ch) {
 	ch->latest_trigger = ctx->generated_samples;
 	ch->sample->latest_trigger = ctx->generated_samples;
 	#endif
+
+	#if XM_TRACE
+	/* Sound effect voices are not in ctx->channels, and trace as
+	   channel 0 */
+	uintptr_t channel = ((uintptr_t)ch - (uintptr_t)ctx->channels)
+		/ sizeof(xm_channel_context_t) + 1;
+	TRACE(ctx, XM_TRACE_NOTE,
+	      (uint8_t)(channel <= NUM_CHANNELS(&ctx->module) ? channel : 0),
+	      ch->orig_note, ch->next_instrument,
+	      (uint32_t)(ch->sample - ctx->samples));
+	#endif
 }
 
 static void xm_cut_note(xm_channel_context_t* ch) {
@@ -1191,7 +1256,45 @@ static void xm_key_off(xm_channel_context_t* ch) {
 	#endif
 }
 
+#if XM_TRANSITIONS
+/* Whether the row about to be read is where the scheduled transition
+   happens */
+static bool xm_transition_due(const xm_context_t* ctx) {
+	if(ctx->transition_rows) {
+		return ctx->current_row % ctx->transition_rows == 0;
+	}
+	return ctx->current_row == 0
+		|| ctx->current_table_index != ctx->transition_from;
+}
+
+static void xm_transition(xm_context_t* ctx) {
+	ctx->transition_pending = false;
+	ctx->current_table_index = ctx->transition_pot;
+	ctx->current_row = ctx->transition_row;
+	TRACE(ctx, XM_TRACE_JUMP, 0, ctx->current_table_index,
+	      ctx->current_row, 0);
+
+	ctx->crossfade_length = ctx->transition_crossfade;
+	ctx->crossfade_remaining = ctx->transition_crossfade;
+	if(ctx->crossfade_remaining == 0) return;
+
+	/* The old section keeps playing in the fading channels (cutting a
+	   crossfade still in progress), the new section starts from
+	   silence */
+	__builtin_memcpy(ctx->fading_channels, ctx->channels,
+	                 sizeof(xm_channel_context_t)
+	                 * NUM_CHANNELS(&ctx->module));
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		ctx->fading_channels[i].current = NULL;
+		ctx->channels[i].sample = NULL;
+		__builtin_memset(ctx->channels[i].actual_volume, 0,
+		                 2 * sizeof(float));
+	}
+}
+#endif
+
 static void xm_row(xm_context_t* ctx) {
+	PROFILE(ctx, XM_PROFILE_ROW);
 	if(POSITION_JUMP(ctx) || PATTERN_BREAK(ctx)) {
 		#if HAS_POSITION_JUMP
 		if(POSITION_JUMP(ctx)) {
@@ -1215,21 +1318,57 @@ static void xm_row(xm_context_t* ctx) {
 		ctx->current_row = ctx->jump_row;
 		ctx->jump_row = 0;
 		#endif
+
+		TRACE(ctx, XM_TRACE_JUMP, 0, ctx->current_table_index,
+		      ctx->current_row, 0);
 	}
 
+	#if XM_TRANSITIONS
+	if(ctx->transition_pending && xm_transition_due(ctx)) {
+		xm_transition(ctx);
+	}
+	#endif
+
+	#if XM_TRACE
+	ctx->trace_table_index = ctx->current_table_index;
+	ctx->trace_row = ctx->current_row;
+	#endif
+	TRACE(ctx, XM_TRACE_ROW, 0,
+	      ctx->module.pattern_table[ctx->current_table_index], 0, 0);
+
 	xm_pattern_t* cur = ctx->patterns
 		+ ctx->module.pattern_table[ctx->current_table_index];
+	#if XM_PACKED_PATTERNS
+	uint32_t offset = ctx->next_packed_offset;
+	if(ctx->next_packed_row != cur->rows_index + ctx->current_row) {
+		/* Not the row following the previous one (jump, break,
+		   seek…), skip rows from the start of the pattern */
+		xm_pattern_slot_t skipped;
+		offset = cur->data_offset;
+		for(uint16_t i = (uint16_t)(ctx->current_row
+		                            * NUM_CHANNELS(&ctx->module));
+		    i; --i) {
+			offset = xm_unpack_slot(ctx, offset, &skipped);
+		}
+	}
+	#else
 	xm_pattern_slot_t* s = ctx->pattern_slots + NUM_CHANNELS(&ctx->module)
 		* (cur->rows_index + ctx->current_row);
+	#endif
 	xm_channel_context_t* ch = ctx->channels;
 	bool in_a_loop = false;
 
 	/* Read notes… */
-	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i, ++ch, ++s) {
-		ch->current = s;
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i, ++ch) {
+		#if XM_PACKED_PATTERNS
+		offset = xm_unpack_slot(ctx, offset, &ch->current_slot);
+		ch->current = &ch->current_slot;
+		#else
+		ch->current = s++;
+		#endif
 
 		if(!HAS_EFFECT(EFFECT_DELAY_NOTE)
-		   || s->effect_type != EFFECT_DELAY_NOTE) {
+		   || ch->current->effect_type != EFFECT_DELAY_NOTE) {
 			xm_handle_pattern_slot(ctx, ch);
 		}
 
@@ -1258,12 +1397,31 @@ static void xm_row(xm_context_t* ctx) {
 		#endif
 	}
 
+	#if XM_PACKED_PATTERNS
+	ctx->next_packed_row = cur->rows_index + ctx->current_row + 1u;
+	ctx->next_packed_offset = offset;
+	#endif
+
 	if(!in_a_loop) {
 		/* No E6y loop is in effect (or we are in the first pass) */
 		#if XM_LOOPING_TYPE == 2
-		ctx->loop_count = ctx->row_loop_count[ctx->current_table_index
-		                                      * MAX_ROWS_PER_PATTERN
-		                                      + ctx->current_row]++;
+		if(ctx->row_loop_order != ctx->current_table_index) {
+			ctx->row_loop_order = ctx->current_table_index;
+			ctx->row_loop_index = (uint16_t)xm_row_loop_index(
+				ctx, ctx->current_table_index);
+		}
+		/* Dxx or xm_seek() can point past the last row of the
+		   pattern, or past the last order */
+		if(ctx->current_table_index < ctx->module.length
+		   && ctx->current_row < ORDER_NUM_ROWS(ctx,
+		                                ctx->current_table_index)) {
+			uint8_t loop_count = ctx->row_loop_count[
+				ctx->row_loop_index + ctx->current_row]++;
+			if(loop_count > ctx->loop_count) {
+				TRACE(ctx, XM_TRACE_LOOP, 0, loop_count, 0, 0);
+			}
+			ctx->loop_count = loop_count;
+		}
 		#endif
 	}
 
@@ -1332,7 +1490,9 @@ static uint8_t xm_tick_envelope([[maybe_unused]] xm_channel_context_t* ch,
 	assert(0);
 }
 
-static void xm_tick_envelopes([[maybe_unused]] xm_channel_context_t* ch) {
+static void xm_tick_envelopes([[maybe_unused]] xm_context_t* ctx,
+                              [[maybe_unused]] xm_channel_context_t* ch) {
+	PROFILE(ctx, XM_PROFILE_TICK_ENVELOPES);
 	xm_instrument_t* inst = INSTRUMENT(ch);
 	if(inst == NULL) return;
 
@@ -1367,7 +1527,110 @@ static void xm_tick_envelopes([[maybe_unused]] xm_channel_context_t* ch) {
 	#endif
 }
 
+/* Update the step and mixing volumes of a channel or sound effect voice, i is
+   its index in ctx->channels then in ctx->sfx_voices (fading channels use the
+   index of their channel). Returns whether the voice is audible. */
+static bool xm_tick_voice(xm_context_t* ctx, xm_channel_context_t* ch,
+                          [[maybe_unused]] uint16_t i) {
+	if(!ch->period) return false;
+
+	/* Don't truncate, actually round up or down, precision matters
+	   here (rounding lets us use 0.5 instead of 1 in the error
+	   formula, see SAMPLE_MICROSTEPS comment) */
+	uint64_t step = (uint64_t)xm_frequency(ctx, ch) * SAMPLE_MICROSTEPS;
+	#if XM_TRANSPOSE
+	/* Music only, sound effects are not transposed */
+	if(i < NUM_CHANNELS(&ctx->module)) {
+		step = (step * ctx->module.pitch_scale
+		        + PITCH_SCALE_UNITY / 2) / PITCH_SCALE_UNITY;
+	}
+	#endif
+	step = (step + CURRENT_SAMPLE_RATE(ctx) / 2) / CURRENT_SAMPLE_RATE(ctx);
+	ch->step = (step > UINT32_MAX) ? UINT32_MAX : (uint32_t)step;
+
+	assert(ch->volume <= MAX_VOLUME);
+	assert(VOLUME_OFFSET(ch) >= -MAX_VOLUME
+	       && VOLUME_OFFSET(ch) <= MAX_VOLUME);
+
+	static_assert(MAX_VOLUME == 1<<6);
+	static_assert(MAX_ENVELOPE_VALUE == 1<<6);
+	static_assert(MAX_FADEOUT_VOLUME == 1<<15);
+
+	/* 6 + 6 + 15 - 2 + 6 => 31 bits of range */
+	int32_t base = ch->volume - VOLUME_OFFSET(ch);
+	#if HAS_VOLUME_OFFSET
+	if(base < 0) base = 0;
+	else if(base > MAX_VOLUME) base = MAX_VOLUME;
+	#endif
+
+	base *= VOLUME_ENVELOPE_VOLUME(ch);
+	base *= FADEOUT_VOLUME(ch);
+	base /= 4;
+	base *= CURRENT_GLOBAL_VOLUME(ctx);
+	float volume =  (float)base / (float)(INT32_MAX);
+	assert(volume >= 0.f && volume <= 1.f);
+
+	#if XM_RAMPING
+	float* out = ch->target_volume;
+	#else
+	float* out = ch->actual_volume;
+	#endif
+
+	#if HAS_PANNING
+	/* Default XM panning (full stereo). Sound effect voices have no
+	   channel panning. */
+	uint8_t base_panning = (i < NUM_CHANNELS(&ctx->module))
+		? BASE_PANNING(ctx, i) : MAX_PANNING/2;
+	uint8_t panning = ch->panning;
+	panning += (uint8_t)
+		((base_panning - MAX_PANNING/2)
+		* (MAX_PANNING/2
+		   - __builtin_abs(ch->panning - MAX_PANNING/2))
+		/ (MAX_PANNING/2));
+	panning += (uint8_t)
+		((PANNING_ENVELOPE_PANNING(ch)
+		   - MAX_ENVELOPE_VALUE/2)
+		* (MAX_PANNING/2
+		   - __builtin_abs(panning - MAX_PANNING/2))
+		/ (MAX_ENVELOPE_VALUE/2));
+
+	/* See https://modarchive.org/forums/index.php?topic=3517.0
+	 * and https://github.com/Artefact2/libxm/pull/16 */
+	out[0] = volume * sqrtf((float)(MAX_PANNING - panning)
+	                        / (float)MAX_PANNING);
+	out[1] = volume * sqrtf((float)panning
+	                        / (float)MAX_PANNING);
+
+	#elif XM_PANNING_TYPE >= 1 && XM_PANNING_TYPE <= 7
+	/* Hard Amiga panning (LRRL) */
+	__builtin_memset(out, 0, 2 * sizeof(float));
+	out[((i >> 1) ^ i) & 1] = volume;
+	#elif XM_PANNING_TYPE == 9
+	/* Scream Tracker 3 default panning (3/C/3/C/...) */
+	out[0] = out[1] = volume * .447265625f;
+	out[i & 1] *= 2.f;
+	#elif XM_PANNING_TYPE == 0
+	/* Mono */
+	out[0] = out[1] = volume * 0.70703125f;
+	#else
+	static_assert(0);
+	#endif
+
+	return ch->sample != NULL && base > 0;
+}
+
+#if XM_SFX_VOICES
+/* Whether a sound effect voice can no longer be heard */
+static bool xm_sfx_voice_done(const xm_channel_context_t* ch) {
+	return ch->volume == 0 || FADEOUT_VOLUME(ch) == 0
+		|| (ch->sample->loop_length == 0
+		    && ch->sample_position
+		       >= ch->sample->length * SAMPLE_MICROSTEPS);
+}
+#endif
+
 void xm_tick(xm_context_t* ctx) {
+	PROFILE(ctx, XM_PROFILE_TICK);
 	#if HAS_EFFECT(EFFECT_DELAY_PATTERN)
 	if(ctx->current_tick >= CURRENT_TEMPO(ctx)) {
 		ctx->current_tick = 0;
@@ -1389,90 +1652,67 @@ void xm_tick(xm_context_t* ctx) {
 	}
 	#endif
 
+	#if XM_PROFILING
+	uint32_t active_voices = 0;
+	#endif
+
 	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
 		xm_channel_context_t* ch = ctx->channels + i;
 
-		xm_tick_envelopes(ch);
+		xm_tick_envelopes(ctx, ch);
 
 		if(ctx->current_tick || EXTRA_ROWS_DONE(ctx)) {
 			xm_tick_effects(ctx, ch);
 		}
 
-		if(!ch->period) continue;
-
-		/* Don't truncate, actually round up or down, precision matters
-		   here (rounding lets us use 0.5 instead of 1 in the error
-		   formula, see SAMPLE_MICROSTEPS comment) */
-		ch->step = (uint32_t)
-			(((uint64_t)xm_frequency(ctx, ch) * SAMPLE_MICROSTEPS
-			  + CURRENT_SAMPLE_RATE(ctx) / 2)
-			 / CURRENT_SAMPLE_RATE(ctx));
-
-		assert(ch->volume <= MAX_VOLUME);
-		assert(VOLUME_OFFSET(ch) >= -MAX_VOLUME
-		       && VOLUME_OFFSET(ch) <= MAX_VOLUME);
-
-		static_assert(MAX_VOLUME == 1<<6);
-		static_assert(MAX_ENVELOPE_VALUE == 1<<6);
-		static_assert(MAX_FADEOUT_VOLUME == 1<<15);
-
-		/* 6 + 6 + 15 - 2 + 6 => 31 bits of range */
-		int32_t base = ch->volume - VOLUME_OFFSET(ch);
-		#if HAS_VOLUME_OFFSET
-		if(base < 0) base = 0;
-		else if(base > MAX_VOLUME) base = MAX_VOLUME;
+		[[maybe_unused]] bool audible = xm_tick_voice(ctx, ch, i);
+		#if XM_PROFILING
+		active_voices += audible;
 		#endif
+	}
 
-		base *= VOLUME_ENVELOPE_VOLUME(ch);
-		base *= FADEOUT_VOLUME(ch);
-		base /= 4;
-		base *= CURRENT_GLOBAL_VOLUME(ctx);
-		float volume =  (float)base / (float)(INT32_MAX);
-		assert(volume >= 0.f && volume <= 1.f);
-
-		#if XM_RAMPING
-		float* out = ch->target_volume;
-		#else
-		float* out = ch->actual_volume;
+	#if XM_TRANSITIONS
+	for(uint8_t i = 0; ctx->crossfade_remaining
+		    && i < NUM_CHANNELS(&ctx->module); ++i) {
+		/* No rows or effects, only envelopes, fadeout and
+		   autovibrato */
+		xm_channel_context_t* ch = ctx->fading_channels + i;
+		xm_tick_envelopes(ctx, ch);
+		[[maybe_unused]] bool audible = xm_tick_voice(ctx, ch, i);
+		#if XM_PROFILING
+		active_voices += audible;
 		#endif
+	}
+	#endif
 
-		#if HAS_PANNING
-		/* Default XM panning (full stereo) */
-		uint8_t panning = ch->panning;
-		panning += (uint8_t)
-			((BASE_PANNING(ctx, i) - MAX_PANNING/2)
-			* (MAX_PANNING/2
-			   - __builtin_abs(ch->panning - MAX_PANNING/2))
-			/ (MAX_PANNING/2));
-		panning += (uint8_t)
-			((PANNING_ENVELOPE_PANNING(ch)
-			   - MAX_ENVELOPE_VALUE/2)
-			* (MAX_PANNING/2
-			   - __builtin_abs(panning - MAX_PANNING/2))
-			/ (MAX_ENVELOPE_VALUE/2));
-
-		/* See https://modarchive.org/forums/index.php?topic=3517.0
-		 * and https://github.com/Artefact2/libxm/pull/16 */
-		out[0] = volume * sqrtf((float)(MAX_PANNING - panning)
-		                        / (float)MAX_PANNING);
-		out[1] = volume * sqrtf((float)panning
-		                        / (float)MAX_PANNING);
-
-		#elif XM_PANNING_TYPE >= 1 && XM_PANNING_TYPE <= 7
-		/* Hard Amiga panning (LRRL) */
-		__builtin_memset(out, 0, 2 * sizeof(float));
-		out[((i >> 1) ^ i) & 1] = volume;
-		#elif XM_PANNING_TYPE == 9
-		/* Scream Tracker 3 default panning (3/C/3/C/...) */
-		out[0] = out[1] = volume * .447265625f;
-		out[i & 1] *= 2.f;
-		#elif XM_PANNING_TYPE == 0
-		/* Mono */
-		out[0] = out[1] = volume * 0.70703125f;
-		#else
-		static_assert(0);
+	#if XM_SFX_VOICES
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		xm_channel_context_t* ch = &ctx->sfx_voices[i].ch;
+		if(ch->sample == NULL) continue;
+		xm_tick_envelopes(ctx, ch);
+		if(xm_sfx_voice_done(ch)) {
+			/* Free the voice, it will fade in from silence when
+			   reused */
+			ch->sample = NULL;
+			__builtin_memset(ch->actual_volume, 0,
+			                 2 * sizeof(float));
+			continue;
+		}
+		[[maybe_unused]] bool audible = xm_tick_voice(ctx, ch,
+		                                   NUM_CHANNELS(&ctx->module) + i);
+		#if XM_PROFILING
+		active_voices += audible;
 		#endif
 	}
+	#endif
+
+	#if XM_PROFILING
+	ctx->profile.active_voices = active_voices;
+	ctx->profile.voice_ticks += active_voices;
+	if(active_voices > ctx->profile.peak_active_voices) {
+		ctx->profile.peak_active_voices = active_voices;
+	}
+	#endif
 
 	ctx->current_tick++;
 
@@ -1486,6 +1726,13 @@ void xm_tick(xm_context_t* ctx) {
 	uint32_t samples_in_tick = CURRENT_SAMPLE_RATE(ctx);
 	samples_in_tick *= 10 * TICK_SUBSAMPLES / 4;
 	samples_in_tick /= CURRENT_BPM(ctx);
+	#if XM_TEMPO_SCALING
+	samples_in_tick = (uint32_t)((uint64_t)samples_in_tick
+	                             * TEMPO_SCALE_UNITY
+	                             / TEMPO_SCALE(&ctx->module));
+	#endif
+	/* xm_sample() ticks at most once per frame */
+	if(samples_in_tick < TICK_SUBSAMPLES) samples_in_tick = TICK_SUBSAMPLES;
 	ctx->remaining_samples_in_tick += samples_in_tick;
 }
 
@@ -1494,6 +1741,7 @@ void xm_tick(xm_context_t* ctx) {
    xm_handle_pattern_slot(). */
 static void xm_tick_effects([[maybe_unused]] xm_context_t* ctx,
                             xm_channel_context_t* ch) {
+	PROFILE(ctx, XM_PROFILE_TICK_EFFECTS);
 	#if HAS_VOLUME_COLUMN
 	switch(VOLUME_COLUMN(ch->current) >> 4) {
 
@@ -1804,7 +2052,7 @@ static void xm_tick_effects([[maybe_unused]] xm_context_t* ctx,
 		if(ctx->current_tick % ch->current->effect_param) break;
 		xm_trigger_instrument(ctx, ch);
 		xm_trigger_note(ctx, ch);
-		xm_tick_envelopes(ch);
+		xm_tick_envelopes(ctx, ch);
 		break;
 	#endif
 
@@ -1825,7 +2073,7 @@ static void xm_tick_effects([[maybe_unused]] xm_context_t* ctx,
 		if(!NOTE_IS_KEY_OFF(ch->current->note)) {
 			xm_trigger_note(ctx, ch);
 		}
-		xm_tick_envelopes(ch);
+		xm_tick_envelopes(ctx, ch);
 		break;
 	#endif
 
@@ -1833,14 +2081,31 @@ static void xm_tick_effects([[maybe_unused]] xm_context_t* ctx,
 }
 
 static float xm_sample_at(const xm_context_t* ctx,
-                          const xm_sample_t* sample, uint32_t k) {
-	assert(k < sample->length);
-	assert(sample->index + k < ctx->module.samples_data_length);
-	return SAMPLE_DATA(ctx, sample->index + k);
+                          xm_channel_context_t* ch, uint32_t k) {
+	assert(k < ch->sample->length);
+	uint32_t idx = ch->sample->index + k;
+	assert(idx < ctx->module.samples_data_length);
+
+	#if XM_ADPCM_SAMPLES
+	/* Decode a whole block at a time, most of the following calls will
+	   read from the same block */
+	uint32_t block = idx / ADPCM_BLOCK_FRAMES + 1;
+	uint8_t c = block % 2;
+	if(ch->adpcm_block[c] != block) {
+		xm_adpcm_decode_block(ctx->samples_data
+		                      + (block - 1) * ADPCM_BLOCK_SIZE,
+		                      ch->adpcm_cache[c]);
+		ch->adpcm_block[c] = block;
+	}
+	return (float)ch->adpcm_cache[c][idx % ADPCM_BLOCK_FRAMES] / 32768.f;
+	#else
+	return SAMPLE_DATA(ctx, idx);
+	#endif
 }
 
-/* XXX: rename me or merge with xm_next_of_channel */
-static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
+/* Returns false if the channel plays silence. Otherwise, removes extra loops
+   from the sample position. */
+static bool xm_wrap_sample_position(xm_channel_context_t* ch) {
 	const xm_sample_t* smp = ch->sample;
 	assert(smp == NULL || smp->loop_length <= smp->length);
 
@@ -1849,14 +2114,7 @@ static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
 	if(SAMPLE_OFFSET_INVALID(ch) || smp == NULL
 	   || (smp->loop_length == 0
 	       && ch->sample_position >= smp->length * SAMPLE_MICROSTEPS)) {
-		#if XM_RAMPING
-		/* Smoothly transition between old sample and silence */
-		if(ch->frame_count >= RAMPING_POINTS) return 0.f;
-		return XM_LERP(ch->end_of_previous_sample[ch->frame_count], .0f,
-		               (float)ch->frame_count / (float)RAMPING_POINTS);
-		#else
-		return 0.f;
-		#endif
+		return false;
 	}
 
 	if(smp->loop_length
@@ -1872,7 +2130,23 @@ static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
 			: smp->loop_length * SAMPLE_MICROSTEPS;
 		ch->sample_position += off;
 	}
+	return true;
+}
 
+/* XXX: rename me or merge with xm_next_of_channel */
+static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
+	if(!xm_wrap_sample_position(ch)) {
+		#if XM_RAMPING
+		/* Smoothly transition between old sample and silence */
+		if(ch->frame_count >= RAMPING_POINTS) return 0.f;
+		return XM_LERP(ch->end_of_previous_sample[ch->frame_count], .0f,
+		               (float)ch->frame_count / (float)RAMPING_POINTS);
+		#else
+		return 0.f;
+		#endif
+	}
+
+	const xm_sample_t* smp = ch->sample;
 	uint32_t a = ch->sample_position / SAMPLE_MICROSTEPS;
 	uint32_t b;
 
@@ -1908,11 +2182,11 @@ static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
 
 	assert(a < smp->length);
 	assert(b < smp->length);
-	float u = (float)xm_sample_at(ctx, smp, a);
+	float u = (float)xm_sample_at(ctx, ch, a);
 
 	#if XM_LINEAR_INTERPOLATION
 	/* u = sample_at(a), v = sample_at(b), t = lerp factor (0..1) */
-	u = XM_LERP(u, (float)xm_sample_at(ctx, smp, b), t);
+	u = XM_LERP(u, (float)xm_sample_at(ctx, ch, b), t);
 	#endif
 
 	#if XM_RAMPING
@@ -1929,33 +2203,107 @@ static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
 
 static void xm_next_of_channel(xm_context_t* ctx, xm_channel_context_t* ch,
                                float* out_left, float* out_right) {
+	#if XM_PROFILING
+	ch->rendered_frames += (ch->sample != NULL);
+	#endif
+
 	const float fval = xm_next_of_sample(ctx, ch) * AMPLIFICATION;
 
-	if(CHANNEL_MUTED(ch)
-	   || (INSTRUMENT(ch) != NULL && INSTRUMENT_MUTED(INSTRUMENT(ch)))
-	   || (MAX_LOOP_COUNT(&ctx->module) > 0
-	       && LOOP_COUNT(ctx) >= MAX_LOOP_COUNT(&ctx->module))) {
-		return;
-	}
+	if(xm_channel_silenced(ctx, ch)) return;
 
 	*out_left += fval * ch->actual_volume[0];
 	*out_right += fval * ch->actual_volume[1];
 
 	#if XM_RAMPING
+	xm_ramp_channel(ch);
+	#endif
+}
+
+static bool xm_channel_silenced(const xm_context_t* ctx,
+                                const xm_channel_context_t* ch) {
+	return CHANNEL_MUTED(ch)
+		|| (INSTRUMENT(ch) != NULL && INSTRUMENT_MUTED(INSTRUMENT(ch)))
+		|| (MAX_LOOP_COUNT(&ctx->module) > 0
+		    && LOOP_COUNT(ctx) >= MAX_LOOP_COUNT(&ctx->module));
+}
+
+#if XM_RAMPING
+static void xm_ramp_channel(xm_channel_context_t* ch) {
 	ch->frame_count++;
 	XM_SLIDE_TOWARDS(&(ch->actual_volume[0]),
 	                 ch->target_volume[0], RAMPING_VOLUME_RAMP);
 	XM_SLIDE_TOWARDS(&(ch->actual_volume[1]),
 	                 ch->target_volume[1], RAMPING_VOLUME_RAMP);
+}
+#endif
+
+/* Same as xm_next_of_channel(), without reading or mixing the sample */
+static void xm_skip_of_channel(const xm_context_t* ctx,
+                               xm_channel_context_t* ch) {
+	#if XM_PROFILING
+	ch->rendered_frames += (ch->sample != NULL);
+	#endif
+
+	/* xm_next_of_sample() does not move while ramping from the previous
+	   sample */
+	if(xm_wrap_sample_position(ch)
+	   #if XM_RAMPING
+	   && ch->frame_count >= RAMPING_POINTS
+	   #endif
+	   ) {
+		ch->sample_position += ch->step;
+	}
+
+	if(xm_channel_silenced(ctx, ch)) return;
+
+	#if XM_RAMPING
+	xm_ramp_channel(ch);
+	#endif
+}
+
+/* Same as xm_sample(), without reading or mixing samples */
+static void xm_skip_sample(xm_context_t* ctx) {
+	if(ckd_sub(&ctx->remaining_samples_in_tick,
+	           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
+		DRAIN_COMMANDS(ctx);
+		xm_tick(ctx);
+	}
+
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_skip_of_channel(ctx, ctx->channels + i);
+	}
+
+	#if XM_TRANSITIONS
+	if(ctx->crossfade_remaining) {
+		for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+			xm_skip_of_channel(ctx, ctx->fading_channels + i);
+		}
+		ctx->crossfade_remaining--;
+	}
+	#endif
+
+	#if XM_SFX_VOICES
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		if(ctx->sfx_voices[i].ch.sample == NULL) continue;
+		xm_skip_of_channel(ctx, &ctx->sfx_voices[i].ch);
+	}
 	#endif
 }
 
 static void xm_sample_unmixed(xm_context_t* ctx, float* out_lr) {
 	if(ckd_sub(&ctx->remaining_samples_in_tick,
 	           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
+		DRAIN_COMMANDS(ctx);
 		xm_tick(ctx);
 	}
 
+	#if XM_TRANSITIONS
+	/* Fading channels are not part of unmixed output, but keep time */
+	if(ctx->crossfade_remaining) {
+		ctx->crossfade_remaining--;
+	}
+	#endif
+
 	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i, out_lr += 2) {
 		__builtin_memset(out_lr, 0, 2 * sizeof(float));
 		xm_next_of_channel(ctx, ctx->channels + i,
@@ -1968,9 +2316,42 @@ static void xm_sample_unmixed(xm_context_t* ctx, float* out_lr) {
 	}
 }
 
+#if XM_PROFILING
+/* End of a xm_generate_samples*() call that started at start */
+static void xm_profile_render(xm_context_t* ctx, uint64_t start,
+                              uint64_t tick_ns, uint16_t numsamples) {
+	xm_profile_t* p = &ctx->profile;
+	uint64_t elapsed = xm_profile_now() - start;
+
+	/* Everything except ticking */
+	p->nanoseconds[XM_PROFILE_MIXER] += elapsed
+		- (p->nanoseconds[XM_PROFILE_TICK] - tick_ns);
+	p->calls[XM_PROFILE_MIXER] += numsamples;
+
+	uint8_t bucket = (uint8_t)(63 - __builtin_clzll(elapsed | 1));
+	if(bucket >= XM_RENDER_HISTOGRAM_BUCKETS) {
+		bucket = XM_RENDER_HISTOGRAM_BUCKETS - 1;
+	}
+	p->render_histogram[bucket]++;
+
+	if(ctx->module.render_deadline
+	   && elapsed > ctx->module.render_deadline) {
+		p->deadline_misses++;
+	}
+
+	if(elapsed > p->worst_render_ns) {
+		p->worst_render_ns = elapsed;
+		p->worst_pattern_index = ctx->current_table_index;
+		p->worst_row = (uint8_t)(ctx->current_row - 1);
+		p->worst_tick = (uint8_t)(ctx->current_tick - 1);
+	}
+}
+#endif
+
 static void xm_sample(xm_context_t* ctx, float* out_left, float* out_right) {
 	if(ckd_sub(&ctx->remaining_samples_in_tick,
 	           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
+		DRAIN_COMMANDS(ctx);
 		xm_tick(ctx);
 	}
 
@@ -1978,45 +2359,332 @@ static void xm_sample(xm_context_t* ctx, float* out_left, float* out_right) {
 		xm_next_of_channel(ctx, ctx->channels + i, out_left, out_right);
 	}
 
-	assert(*out_left <= NUM_CHANNELS(&ctx->module));
-	assert(*out_left >= -NUM_CHANNELS(&ctx->module));
-	assert(*out_right <= NUM_CHANNELS(&ctx->module));
-	assert(*out_right >= -NUM_CHANNELS(&ctx->module));
+	xm_finish_sample(ctx, out_left, out_right);
 }
 
+/* Mix what plays over the module channels, already mixed in out_left and
+   out_right: the old section of a crossfade, and sound effects */
+static void xm_finish_sample([[maybe_unused]] xm_context_t* ctx,
+                             float* out_left, float* out_right) {
+	#if XM_TRANSITIONS
+	if(ctx->crossfade_remaining) {
+		xm_crossfade(ctx, out_left, out_right);
+	}
+	#endif
+
+	#if XM_SFX_VOICES
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		if(ctx->sfx_voices[i].ch.sample == NULL) continue;
+		xm_next_of_channel(ctx, &ctx->sfx_voices[i].ch,
+		                   out_left, out_right);
+	}
+	#endif
+
+	/* Crossfade gains add up to at most sqrt(2) */
+	[[maybe_unused]] float max = NUM_CHANNELS(&ctx->module)
+		* (1.f + .5f * XM_TRANSITIONS) + XM_SFX_VOICES;
+	assert(*out_left <= max && *out_left >= -max);
+	assert(*out_right <= max && *out_right >= -max);
+}
+
+#if XM_TRANSITIONS
+/* Fade out the fading channels and fade in the new section already mixed in
+   out_left and out_right, with equal power gains */
+static void xm_crossfade(xm_context_t* ctx,
+                         float* out_left, float* out_right) {
+	float left = 0.f, right = 0.f;
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		xm_next_of_channel(ctx, ctx->fading_channels + i,
+		                   &left, &right);
+	}
+
+	float x = (float)(ctx->crossfade_length - ctx->crossfade_remaining)
+		/ (float)ctx->crossfade_length * 0x1.921fb6p0f; /* 0..pi/2 */
+	float fade_in = sinf(x), fade_out = cosf(x);
+	*out_left = *out_left * fade_in + left * fade_out;
+	*out_right = *out_right * fade_in + right * fade_out;
+	ctx->crossfade_remaining--;
+}
+#endif
+
 void xm_generate_samples(xm_context_t* ctx,
                          float* output,
                          uint16_t numsamples) {
+	DRAIN_COMMANDS(ctx);
 	#if XM_TIMING_FUNCTIONS
 	ctx->generated_samples += numsamples;
 	#endif
+	#if XM_PROFILING
+	uint64_t profile_start = xm_profile_now();
+	uint64_t profile_tick_ns = ctx->profile.nanoseconds[XM_PROFILE_TICK];
+	#endif
 	for(uint16_t i = 0; i < numsamples; i++, output += 2) {
 		__builtin_memset(output, 0, 2 * sizeof(float));
 		xm_sample(ctx, output, output + 1);
 	}
+	#if XM_PROFILING
+	xm_profile_render(ctx, profile_start, profile_tick_ns, numsamples);
+	#endif
 }
 
 void xm_generate_samples_noninterleaved(xm_context_t* ctx,
                                         float* out_left, float* out_right,
                                         uint16_t numsamples) {
+	DRAIN_COMMANDS(ctx);
 	#if XM_TIMING_FUNCTIONS
 	ctx->generated_samples += numsamples;
 	#endif
+	#if XM_PROFILING
+	uint64_t profile_start = xm_profile_now();
+	uint64_t profile_tick_ns = ctx->profile.nanoseconds[XM_PROFILE_TICK];
+	#endif
 	for(uint16_t i = 0; i < numsamples; ++i) {
 		*out_left = 0.f;
 		*out_right = 0.f;
 		xm_sample(ctx, out_left++, out_right++);
 	}
+	#if XM_PROFILING
+	xm_profile_render(ctx, profile_start, profile_tick_ns, numsamples);
+	#endif
 }
 
 void xm_generate_samples_unmixed(xm_context_t* ctx,
                                  float* out,
                                  uint16_t numsamples) {
+	DRAIN_COMMANDS(ctx);
 	#if XM_TIMING_FUNCTIONS
 	ctx->generated_samples += numsamples;
 	#endif
+	#if XM_PROFILING
+	uint64_t profile_start = xm_profile_now();
+	uint64_t profile_tick_ns = ctx->profile.nanoseconds[XM_PROFILE_TICK];
+	#endif
 	for(uint16_t i = 0; i < numsamples;
 	    ++i, out += NUM_CHANNELS(&ctx->module) * 2) {
 		xm_sample_unmixed(ctx, out);
 	}
+	#if XM_PROFILING
+	xm_profile_render(ctx, profile_start, profile_tick_ns, numsamples);
+	#endif
+}
+
+static void xm_generate_samples_batch_task(void* data, uint32_t i) {
+	const xm_batch_t* batch = data;
+	xm_generate_samples(batch->ctxs[i], batch->outputs[i], batch->numsamples);
+}
+
+void xm_generate_samples_batch(xm_context_t* const* ctxs,
+                               float* const* outputs, uint32_t count,
+                               uint16_t numsamples,
+                               xm_parallel_for_t* parallel_for,
+                               void* parallel_for_data) {
+	xm_batch_t batch = {
+		.ctxs = ctxs,
+		.outputs = outputs,
+		.numsamples = numsamples,
+	};
+	if(parallel_for == nullptr) {
+		for(uint32_t i = 0; i < count; ++i) {
+			xm_generate_samples_batch_task(&batch, i);
+		}
+		return;
+	}
+	parallel_for(parallel_for_data, count, xm_generate_samples_batch_task,
+	             &batch);
+}
+
+#if XM_PARALLEL_MIXING
+static void xm_mix_channel_group(void* data, uint32_t group) {
+	const xm_mix_tasks_t* t = data;
+	float* acc = t->accumulators + group * t->stride;
+	__builtin_memset(acc, 0, 2 * t->numsamples * sizeof(float));
+
+	uint32_t end = (group + 1) * MIX_GROUP_CHANNELS;
+	if(end > NUM_CHANNELS(&t->ctx->module)) {
+		end = NUM_CHANNELS(&t->ctx->module);
+	}
+	/* Channels only share read-only data until the next tick */
+	for(uint32_t i = group * MIX_GROUP_CHANNELS; i < end; ++i) {
+		for(uint16_t j = 0; j < t->numsamples; ++j) {
+			xm_next_of_channel(t->ctx, t->ctx->channels + i,
+			                   acc + 2 * j, acc + 2 * j + 1);
+		}
+	}
+}
+#endif
+
+void xm_skip_samples(xm_context_t* ctx, uint32_t numsamples) {
+	DRAIN_COMMANDS(ctx);
+	#if XM_TIMING_FUNCTIONS
+	ctx->generated_samples += numsamples;
+	#endif
+	while(numsamples--) {
+		xm_skip_sample(ctx);
+	}
+}
+
+uint32_t xm_size_for_parallel_mixing([[maybe_unused]]
+                                     const xm_context_t* ctx,
+                                     [[maybe_unused]] uint16_t numsamples) {
+	#if XM_PARALLEL_MIXING
+	return NUM_MIX_GROUPS(&ctx->module) * 2u * numsamples
+		* (uint32_t)sizeof(float);
+	#else
+	return 0;
+	#endif
+}
+
+void xm_generate_samples_parallel(xm_context_t* restrict ctx,
+                                  float* restrict output,
+                                  uint16_t numsamples,
+                                  [[maybe_unused]] char* restrict pool,
+                                  [[maybe_unused]]
+                                  xm_parallel_for_t* parallel_for,
+                                  [[maybe_unused]] void* parallel_for_data) {
+	#if XM_PARALLEL_MIXING
+	DRAIN_COMMANDS(ctx);
+	#if XM_TIMING_FUNCTIONS
+	ctx->generated_samples += numsamples;
+	#endif
+	#if XM_PROFILING
+	uint64_t profile_start = xm_profile_now();
+	uint64_t profile_tick_ns = ctx->profile.nanoseconds[XM_PROFILE_TICK];
+	uint16_t total = numsamples;
+	#endif
+
+	uint32_t groups = NUM_MIX_GROUPS(&ctx->module);
+	xm_mix_tasks_t tasks = {
+		.ctx = ctx,
+		.accumulators = (float*)pool,
+		.stride = 2u * numsamples,
+	};
+	while(numsamples) {
+		/* Tick like xm_sample() would, then mix every frame up to the
+		   next tick at once */
+		if(ckd_sub(&ctx->remaining_samples_in_tick,
+		           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
+			DRAIN_COMMANDS(ctx);
+			xm_tick(ctx);
+		}
+		uint32_t n = 1 + ctx->remaining_samples_in_tick / TICK_SUBSAMPLES;
+		if(n > numsamples) n = numsamples;
+		ctx->remaining_samples_in_tick -= (n - 1) * TICK_SUBSAMPLES;
+		tasks.numsamples = (uint16_t)n;
+
+		if(parallel_for == nullptr) {
+			for(uint32_t g = 0; g < groups; ++g) {
+				xm_mix_channel_group(&tasks, g);
+			}
+		} else {
+			parallel_for(parallel_for_data, groups,
+			             xm_mix_channel_group, &tasks);
+		}
+
+		for(uint16_t j = 0; j < n; ++j, output += 2) {
+			__builtin_memset(output, 0, 2 * sizeof(float));
+			for(uint32_t g = 0; g < groups; ++g) {
+				const float* acc = tasks.accumulators
+					+ g * tasks.stride + 2 * j;
+				output[0] += acc[0];
+				output[1] += acc[1];
+			}
+			xm_finish_sample(ctx, output, output + 1);
+		}
+		numsamples -= (uint16_t)n;
+	}
+
+	#if XM_PROFILING
+	xm_profile_render(ctx, profile_start, profile_tick_ns, total);
+	#endif
+	#else
+	xm_generate_samples(ctx, output, numsamples);
+	#endif
+}
+
+uint8_t xm_play_sfx([[maybe_unused]] xm_context_t* ctx,
+                    [[maybe_unused]] uint8_t instr,
+                    [[maybe_unused]] uint8_t note,
+                    [[maybe_unused]] uint8_t volume,
+                    [[maybe_unused]] uint8_t panning,
+                    [[maybe_unused]] uint8_t priority) {
+	#if XM_SFX_VOICES
+	assert(instr >= 1 && instr <= NUM_INSTRUMENTS(&ctx->module));
+	assert(note >= 1 && note <= MAX_NOTE);
+	assert(volume <= MAX_VOLUME);
+
+	/* Take a free voice, or steal the lowest priority voice (the oldest
+	   one if tied) that does not have a higher priority */
+	xm_sfx_voice_t* v = NULL;
+	uint32_t age = 0;
+	for(uint8_t i = 0; i < XM_SFX_VOICES; ++i) {
+		xm_sfx_voice_t* w = ctx->sfx_voices + i;
+		if(w->age >= age) age = w->age + 1;
+		if(v != NULL && v->ch.sample == NULL) continue;
+		if(w->ch.sample == NULL) {
+			v = w;
+		} else if(w->priority <= priority
+		          && (v == NULL || w->priority < v->priority
+		              || (w->priority == v->priority
+		                  && w->age < v->age))) {
+			v = w;
+		}
+	}
+	if(v == NULL) {
+		return 0;
+	}
+
+	xm_channel_context_t* ch = &v->ch;
+	ch->current = &ctx->sfx_slot;
+	ch->next_instrument = instr;
+	ch->orig_note = note;
+	xm_trigger_note(ctx, ch);
+	if(ch->sample == NULL) {
+		/* Invalid instrument or sample */
+		return 0;
+	}
+	ch->volume = volume;
+	#if HAS_PANNING
+	ch->panning = panning;
+	#endif
+	xm_trigger_instrument(ctx, ch);
+	v->age = age;
+	v->priority = priority;
+
+	/* Like a note triggered by a row, start with this tick's envelopes and
+	   volume instead of waiting for the next tick */
+	xm_tick_envelopes(ctx, ch);
+	xm_tick_voice(ctx, ch,
+	              (uint16_t)(NUM_CHANNELS(&ctx->module) + (v - ctx->sfx_voices)));
+	return (uint8_t)(v - ctx->sfx_voices + 1);
+	#else
+	return 0;
+	#endif
+}
+
+void xm_release_sfx([[maybe_unused]] xm_context_t* ctx,
+                    [[maybe_unused]] uint8_t voice) {
+	#if XM_SFX_VOICES
+	assert(voice >= 1 && voice <= XM_SFX_VOICES);
+	xm_channel_context_t* ch = &ctx->sfx_voices[voice - 1].ch;
+	if(ch->sample) xm_key_off(ch);
+	#endif
+}
+
+void xm_stop_sfx([[maybe_unused]] xm_context_t* ctx,
+                 [[maybe_unused]] uint8_t voice) {
+	#if XM_SFX_VOICES
+	assert(voice >= 1 && voice <= XM_SFX_VOICES);
+	/* Freed at the next tick, after ramping down */
+	xm_cut_note(&ctx->sfx_voices[voice - 1].ch);
+	#endif
+}
+
+bool xm_is_sfx_playing([[maybe_unused]] const xm_context_t* ctx,
+                       [[maybe_unused]] uint8_t voice) {
+	#if XM_SFX_VOICES
+	assert(voice >= 1 && voice <= XM_SFX_VOICES);
+	return ctx->sfx_voices[voice - 1].ch.sample != NULL;
+	#else
+	return false;
+	#endif
 }
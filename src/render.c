@@ -0,0 +1,340 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+
+#define POOL_ALIGN(x) (((x) + alignof(max_align_t) - 1) \
+                       & ~(alignof(max_align_t) - 1))
+
+/* Segment i of xm_render_parallel() is rendered by the clone at
+   pool + i * clone_size */
+struct xm_segments_s {
+	char* pool;
+	float* output;
+	uint32_t clone_size;
+	uint32_t segment_length;
+	uint32_t numsamples;
+	char __pad[4];
+};
+typedef struct xm_segments_s xm_segments_t;
+
+static void xm_render_segment(void*, uint32_t) __attribute__((nonnull));
+
+#if XM_RENDER_THREAD
+#include <stdatomic.h>
+#include <threads.h>
+
+#define COMMAND_QUEUE_SIZE 1024
+
+/* The render thread is the only producer of frames and positions, the
+   thread calling xm_read_render_thread() the only consumer. Frame counters
+   are free running. */
+struct xm_render_thread_s {
+	_Atomic uint64_t write; /* Frames rendered, only stored by the
+	                           render thread */
+	_Atomic uint64_t read; /* Frames read, only stored by the reader */
+
+	xm_context_t* ctx;
+	xm_command_queue_t* commands;
+
+	/* Packed position after each period, indexed by
+	   (frame / period) % num_positions, see xm_pack_position() */
+	_Atomic uint64_t* positions;
+
+	float* ring; /* latency interleaved frames */
+	float* scratch; /* period interleaved frames */
+	thrd_t thread;
+
+	uint32_t latency;
+	uint32_t num_positions;
+	_Atomic uint32_t underruns; /* Only stored by the reader */
+	uint16_t period;
+	atomic_bool stop;
+	char __pad[1];
+};
+
+static uint32_t xm_render_thread_layout(uint32_t, uint16_t, uint32_t*,
+                                        uint32_t*, uint32_t*, uint32_t*);
+static uint64_t xm_pack_position(const xm_context_t*)
+	__attribute__((nonnull));
+static void xm_copy_frames(float*, uint32_t, uint64_t,
+                           const float*, uint32_t, uint64_t, uint32_t)
+	__attribute__((nonnull));
+static int xm_render_thread_main(void*) __attribute__((nonnull));
+#endif
+
+/* ----- Function definitions ----- */
+
+uint32_t xm_size_for_render_parallel(const xm_context_t* ctx,
+                                     uint32_t segments) {
+	return segments * (uint32_t)POOL_ALIGN(xm_clone_size(ctx));
+}
+
+static void xm_render_segment(void* data, uint32_t i) {
+	const xm_segments_t* s = data;
+	xm_context_t* ctx = (xm_context_t*)(s->pool + i * s->clone_size);
+	float* output = s->output + 2ull * i * s->segment_length;
+	uint32_t n = s->numsamples - i * s->segment_length;
+	if(n > s->segment_length) n = s->segment_length;
+
+	while(n) {
+		uint16_t chunk = (n > UINT16_MAX) ? UINT16_MAX : (uint16_t)n;
+		xm_generate_samples(ctx, output, chunk);
+		output += 2 * chunk;
+		n -= chunk;
+	}
+}
+
+void xm_render_parallel(xm_context_t* restrict ctx, float* restrict output,
+                        uint32_t numsamples, uint32_t segments,
+                        char* restrict pool, xm_parallel_for_t* parallel_for,
+                        void* parallel_for_data) {
+	assert(segments > 0);
+	xm_segments_t s = {
+		.pool = pool,
+		.output = output,
+		.clone_size = (uint32_t)POOL_ALIGN(xm_clone_size(ctx)),
+		.segment_length = numsamples / segments
+		                  + (numsamples % segments != 0),
+		.numsamples = numsamples,
+	};
+	if(numsamples == 0) return;
+	/* Rounding up the length can leave the last segments empty */
+	segments = numsamples / s.segment_length
+		+ (numsamples % s.segment_length != 0);
+
+	/* Play the whole range without mixing, forking a clone at the start
+	   of each segment. This leaves ctx where xm_generate_samples() would
+	   have. */
+	for(uint32_t i = 0; i < segments; ++i) {
+		[[maybe_unused]] xm_context_t* clone =
+			xm_clone_context(pool + i * s.clone_size, ctx);
+		uint32_t n = numsamples - i * s.segment_length;
+		xm_skip_samples(ctx, (n < s.segment_length)
+		                ? n : s.segment_length);
+	}
+
+	if(parallel_for == nullptr) {
+		for(uint32_t i = 0; i < segments; ++i) {
+			xm_render_segment(&s, i);
+		}
+		return;
+	}
+	parallel_for(parallel_for_data, segments, xm_render_segment, &s);
+}
+
+#if XM_RENDER_THREAD
+/* Returns the pool size, and the offsets of each array in the pool */
+static uint32_t xm_render_thread_layout(uint32_t latency, uint16_t period,
+                                        uint32_t* num_positions,
+                                        uint32_t* commands_offset,
+                                        uint32_t* ring_offset,
+                                        uint32_t* scratch_offset) {
+	/* The reader is at most latency frames behind the writer, leave one
+	   more period so that the position being read is never overwritten */
+	*num_positions = latency / period + 2;
+
+	uint32_t sz = POOL_ALIGN((uint32_t)sizeof(xm_render_thread_t)
+	                         + *num_positions * (uint32_t)sizeof(uint64_t));
+	*commands_offset = sz;
+	sz += COMMAND_QUEUE_SIZE;
+	*ring_offset = sz;
+	sz += latency * 2 * (uint32_t)sizeof(float);
+	*scratch_offset = sz;
+	sz += period * 2 * (uint32_t)sizeof(float);
+	return sz;
+}
+
+static uint64_t xm_pack_position(const xm_context_t* ctx) {
+	uint8_t pattern_index, pattern, row;
+	uint32_t samples;
+	xm_get_position(ctx, &pattern_index, &pattern, &row, &samples);
+	return (uint64_t)pattern_index
+		| (uint64_t)pattern << 8
+		| (uint64_t)row << 16
+		| (uint64_t)xm_get_loop_count(ctx) << 24
+		| (uint64_t)samples << 32;
+}
+
+/* Copy n frames, wrapping around either ring buffer */
+static void xm_copy_frames(float* dest, uint32_t dest_len, uint64_t dest_off,
+                           const float* src, uint32_t src_len,
+                           uint64_t src_off, uint32_t n) {
+	while(n) {
+		uint32_t d = (uint32_t)(dest_off % dest_len);
+		uint32_t s = (uint32_t)(src_off % src_len);
+		uint32_t chunk = n;
+		if(chunk > dest_len - d) chunk = dest_len - d;
+		if(chunk > src_len - s) chunk = src_len - s;
+		__builtin_memcpy(dest + 2 * d, src + 2 * s,
+		                 chunk * 2 * sizeof(float));
+		dest_off += chunk;
+		src_off += chunk;
+		n -= chunk;
+	}
+}
+
+static int xm_render_thread_main(void* arg) {
+	xm_render_thread_t* r = arg;
+	while(!atomic_load_explicit(&r->stop, memory_order_relaxed)) {
+		uint64_t write = atomic_load_explicit(&r->write,
+		                                      memory_order_relaxed);
+		uint64_t read = atomic_load_explicit(&r->read,
+		                                     memory_order_acquire);
+
+		if(write - read + r->period > r->latency) {
+			/* Full, the reader needs at least half a period to make
+			   room for a new one */
+			uint64_t ns = 500000000ull * r->period
+				/ xm_get_sample_rate(r->ctx);
+			thrd_sleep(&(struct timespec){
+					.tv_sec = (time_t)(ns / 1000000000),
+					.tv_nsec = (long)(ns % 1000000000),
+				}, nullptr);
+			continue;
+		}
+
+		xm_drain_commands(r->ctx, r->commands);
+		xm_generate_samples(r->ctx, r->scratch, r->period);
+		xm_copy_frames(r->ring, r->latency, write,
+		               r->scratch, r->period, 0, r->period);
+		atomic_store_explicit(r->positions
+		                      + (write / r->period + 1) % r->num_positions,
+		                      xm_pack_position(r->ctx),
+		                      memory_order_release);
+		atomic_store_explicit(&r->write, write + r->period,
+		                      memory_order_release);
+	}
+	return 0;
+}
+#endif
+
+uint32_t xm_size_for_render_thread([[maybe_unused]] uint32_t latency,
+                                   [[maybe_unused]] uint16_t period) {
+	#if XM_RENDER_THREAD
+	uint32_t unused;
+	return xm_render_thread_layout(latency, period, &unused, &unused,
+	                               &unused, &unused);
+	#else
+	return 0;
+	#endif
+}
+
+xm_render_thread_t* xm_start_render_thread([[maybe_unused]] char* pool,
+                                           [[maybe_unused]]
+                                           xm_context_t* ctx,
+                                           [[maybe_unused]] uint32_t latency,
+                                           [[maybe_unused]] uint16_t period) {
+	#if XM_RENDER_THREAD
+	if(period == 0 || latency < period) {
+		return nullptr;
+	}
+
+	uint32_t num_positions, commands_offset, ring_offset, scratch_offset;
+	xm_render_thread_layout(latency, period, &num_positions,
+	                        &commands_offset, &ring_offset,
+	                        &scratch_offset);
+
+	xm_render_thread_t* r = (xm_render_thread_t*)pool;
+	*r = (xm_render_thread_t){
+		.ctx = ctx,
+		.commands = xm_create_command_queue(pool + commands_offset,
+		                                    COMMAND_QUEUE_SIZE),
+		.positions = (_Atomic uint64_t*)(pool
+		                                 + sizeof(xm_render_thread_t)),
+		.ring = (float*)(pool + ring_offset),
+		.scratch = (float*)(pool + scratch_offset),
+		.latency = latency,
+		.num_positions = num_positions,
+		.period = period,
+	};
+	for(uint32_t i = 0; i < num_positions; ++i) {
+		atomic_init(r->positions + i, xm_pack_position(ctx));
+	}
+
+	if(thrd_create(&r->thread, xm_render_thread_main, r) != thrd_success) {
+		NOTICE("could not start render thread");
+		return nullptr;
+	}
+	return r;
+	#else
+	return nullptr;
+	#endif
+}
+
+void xm_stop_render_thread([[maybe_unused]] xm_render_thread_t* r) {
+	#if XM_RENDER_THREAD
+	atomic_store_explicit(&r->stop, true, memory_order_relaxed);
+	thrd_join(r->thread, nullptr);
+	#endif
+}
+
+uint32_t xm_read_render_thread([[maybe_unused]] xm_render_thread_t* restrict r,
+                               float* restrict output, uint32_t numsamples) {
+	uint32_t n = 0;
+	#if XM_RENDER_THREAD
+	uint64_t read = atomic_load_explicit(&r->read, memory_order_relaxed);
+	uint64_t available = atomic_load_explicit(&r->write,
+	                                          memory_order_acquire) - read;
+	n = (available < numsamples) ? (uint32_t)available : numsamples;
+
+	xm_copy_frames(output, numsamples, 0, r->ring, r->latency, read, n);
+	atomic_store_explicit(&r->read, read + n, memory_order_release);
+
+	if(n < numsamples) {
+		atomic_store_explicit(&r->underruns,
+		                      atomic_load_explicit(&r->underruns,
+		                                           memory_order_relaxed)
+		                      + 1, memory_order_relaxed);
+	}
+	#endif
+	__builtin_memset(output + 2 * n, 0,
+	                 (numsamples - n) * 2 * sizeof(float));
+	return n;
+}
+
+uint32_t xm_get_render_thread_underruns([[maybe_unused]]
+                                        const xm_render_thread_t* r) {
+	#if XM_RENDER_THREAD
+	return atomic_load_explicit(&r->underruns, memory_order_relaxed);
+	#else
+	return 0;
+	#endif
+}
+
+xm_command_queue_t* xm_get_render_thread_commands([[maybe_unused]]
+                                                  xm_render_thread_t* r) {
+	#if XM_RENDER_THREAD
+	return r->commands;
+	#else
+	return nullptr;
+	#endif
+}
+
+void xm_get_render_thread_position([[maybe_unused]]
+                                   const xm_render_thread_t* r,
+                                   uint8_t* pattern_index, uint8_t* pattern,
+                                   uint8_t* row, uint8_t* loop_count,
+                                   uint32_t* samples) {
+	uint64_t pos = 0;
+	uint32_t offset = 0;
+	#if XM_RENDER_THREAD
+	/* read <= write, so this period was rendered, and the reader is not
+	   far enough behind for its position to be overwritten yet */
+	uint64_t read = atomic_load_explicit(&r->read, memory_order_acquire);
+	pos = atomic_load_explicit(r->positions
+	                           + read / r->period % r->num_positions,
+	                           memory_order_acquire);
+	offset = (uint32_t)(read % r->period);
+	#endif
+	if(pattern_index) *pattern_index = (uint8_t)pos;
+	if(pattern) *pattern = (uint8_t)(pos >> 8);
+	if(row) *row = (uint8_t)(pos >> 16);
+	if(loop_count) *loop_count = (uint8_t)(pos >> 24);
+	if(samples) *samples = (uint32_t)(pos >> 32) + offset;
+}
@@ -0,0 +1,85 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+#include <stdatomic.h>
+
+/* Single producer (the thread playing the context), single consumer (the
+   thread calling xm_drain_trace()) */
+struct xm_trace_s {
+	xm_ring_t ring;
+	_Atomic uint32_t drops; /* Only stored by the producer */
+	xm_trace_record_t records[];
+};
+
+/* ----- Function definitions ----- */
+
+xm_trace_t* xm_create_trace(char* pool, uint32_t pool_size) {
+	if(pool_size < sizeof(xm_trace_t) + sizeof(xm_trace_record_t)) {
+		return nullptr;
+	}
+
+	xm_trace_t* trace = (xm_trace_t*)pool;
+	xm_ring_init(&trace->ring, (pool_size - (uint32_t)sizeof(xm_trace_t))
+	                           / (uint32_t)sizeof(xm_trace_record_t));
+	atomic_init(&trace->drops, 0);
+	return trace;
+}
+
+void xm_set_trace([[maybe_unused]] xm_context_t* restrict ctx,
+                  [[maybe_unused]] xm_trace_t* restrict trace) {
+	#if XM_TRACE
+	ctx->module.trace = trace;
+	#endif
+}
+
+uint32_t xm_drain_trace(xm_trace_t* restrict trace,
+                        xm_trace_record_t* restrict out, uint32_t max) {
+	uint32_t first;
+	uint32_t available = xm_ring_acquire_read(&trace->ring, &first);
+	if(available > max) available = max;
+
+	for(uint32_t i = 0; i < available; ++i) {
+		out[i] = trace->records[(first + i) & trace->ring.mask];
+	}
+
+	xm_ring_release_read(&trace->ring, available);
+	return available;
+}
+
+uint32_t xm_get_trace_drops(const xm_trace_t* trace) {
+	return atomic_load_explicit(&trace->drops, memory_order_relaxed);
+}
+
+#if XM_TRACE
+void xm_trace(xm_context_t* ctx, uint16_t event, uint8_t channel,
+              uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+	xm_trace_t* trace = ctx->module.trace;
+	uint32_t index;
+	if(!xm_ring_acquire_write(&trace->ring, &index)) {
+		atomic_store_explicit(&trace->drops,
+		                      atomic_load_explicit(&trace->drops,
+		                                           memory_order_relaxed)
+		                      + 1, memory_order_relaxed);
+		return;
+	}
+
+	trace->records[index] = (xm_trace_record_t){
+		#if XM_TIMING_FUNCTIONS
+		.samples = ctx->generated_samples,
+		#endif
+		.args = { arg0, arg1, arg2 },
+		.event = event,
+		.pattern_index = ctx->trace_table_index,
+		.row = ctx->trace_row,
+		.tick = ctx->current_tick,
+		.channel = channel,
+	};
+	xm_ring_release_write(&trace->ring);
+}
+#endif
@@ -0,0 +1,27 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "xm_internal.h"
+
+#ifndef XM_VARIANT_NAME
+#define XM_VARIANT_NAME "full"
+#endif
+
+/* Builds with XM_SYMBOL_PREFIX rename this, so that xm_get_variant() can list
+   every variant */
+const xm_variant_t xm_variant = {
+	.name = XM_VARIANT_NAME,
+	.disabled_effects = XM_DISABLED_EFFECTS,
+	.disabled_features = XM_DISABLED_FEATURES,
+	.disabled_volume_effects = XM_DISABLED_VOLUME_EFFECTS,
+	.panning_type = XM_PANNING_TYPE,
+	.prescan_data_size = sizeof(xm_prescan_data_t),
+	#define XM_VARIANT_INITIALIZER(f) .f = xm_##f,
+	XM_VARIANT_FUNCTIONS(XM_VARIANT_INITIALIZER)
+	#undef XM_VARIANT_INITIALIZER
+};
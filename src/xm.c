@@ -7,7 +7,11 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details. */
 
 #include "xm_internal.h"
+#include <stdatomic.h>
 
+#if XM_PROFILING
+#include <time.h>
+#endif
 
 
 uint16_t xm_rand16(uint32_t* state) {
@@ -15,6 +19,156 @@ uint16_t xm_rand16(uint32_t* state) {
 	return (uint16_t)(*state = *state * 0xD9F5 + 1);
 }
 
+void xm_ring_init(xm_ring_t* ring, uint32_t max_items) {
+	assert(max_items > 0);
+	atomic_init(&ring->write, 0);
+	atomic_init(&ring->read, 0);
+	ring->mask = stdc_bit_floor(max_items) - 1;
+}
+
+bool xm_ring_acquire_write(xm_ring_t* ring, uint32_t* index) {
+	uint32_t write = atomic_load_explicit(&ring->write,
+	                                      memory_order_relaxed);
+	if(write - atomic_load_explicit(&ring->read, memory_order_acquire)
+	   > ring->mask) {
+		return false;
+	}
+	*index = write & ring->mask;
+	return true;
+}
+
+void xm_ring_release_write(xm_ring_t* ring) {
+	/* Only the producer stores write, a relaxed increment is enough */
+	atomic_store_explicit(&ring->write,
+	                      atomic_load_explicit(&ring->write,
+	                                           memory_order_relaxed) + 1,
+	                      memory_order_release);
+}
+
+uint32_t xm_ring_acquire_read(xm_ring_t* ring, uint32_t* first) {
+	*first = atomic_load_explicit(&ring->read, memory_order_relaxed);
+	return atomic_load_explicit(&ring->write, memory_order_acquire)
+		- *first;
+}
+
+void xm_ring_release_read(xm_ring_t* ring, uint32_t count) {
+	atomic_store_explicit(&ring->read,
+	                      atomic_load_explicit(&ring->read,
+	                                           memory_order_relaxed)
+	                      + count, memory_order_release);
+}
+
+#if XM_LOOPING_TYPE == 2
+uint32_t xm_row_loop_index(const xm_context_t* ctx, uint16_t order) {
+	uint32_t index = 0;
+	for(uint16_t i = 0; i < order; ++i) {
+		index += ORDER_NUM_ROWS(ctx, i);
+	}
+	return index;
+}
+#endif
+
+#if XM_PACKED_PATTERNS
+uint32_t xm_unpack_slot(const xm_context_t* ctx, uint32_t offset,
+                        xm_pattern_slot_t* s) {
+	const uint8_t* data = (const uint8_t*)ctx->pattern_slots + offset;
+
+	if(offset >= ctx->module.pattern_data_length) {
+		/* Dxx can jump past the last row of the last pattern */
+		__builtin_memset(s, 0, sizeof(xm_pattern_slot_t));
+		return offset;
+	}
+
+	if(!(data[0] & PACKED_SLOT_MASK)) {
+		__builtin_memcpy(s, data, sizeof(xm_pattern_slot_t));
+		if(s->note == PACKED_NOTE_KEY_OFF) {
+			s->note = NOTE_KEY_OFF;
+		}
+		return offset + (uint32_t)sizeof(xm_pattern_slot_t);
+	}
+
+	uint8_t mask = *data++;
+	__builtin_memset(s, 0, sizeof(xm_pattern_slot_t));
+	if(mask & PACKED_SLOT_NOTE) s->note = *data++;
+	if(mask & PACKED_SLOT_INSTRUMENT) s->instrument = *data++;
+	#if HAS_VOLUME_COLUMN
+	if(mask & PACKED_SLOT_VOLUME_COLUMN) s->volume_column = *data++;
+	#endif
+	if(mask & PACKED_SLOT_EFFECT_TYPE) s->effect_type = *data++;
+	if(mask & PACKED_SLOT_EFFECT_PARAM) s->effect_param = *data++;
+	return (uint32_t)(data - (const uint8_t*)ctx->pattern_slots);
+}
+#endif
+
+#if XM_ADPCM_SAMPLES
+static constexpr int16_t adpcm_steps[] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+	41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+	190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+	724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
+	18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+static constexpr int8_t adpcm_index_adjust[] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+};
+#define ADPCM_MAX_INDEX 88
+static_assert(sizeof(adpcm_steps) == sizeof(int16_t) * (ADPCM_MAX_INDEX + 1));
+
+/* Update the decoder state with one nibble; the encoder uses the exact same
+   logic so both sides never drift apart */
+static void xm_adpcm_step(int16_t* predictor, uint8_t* index, uint8_t nibble) {
+	int32_t step = adpcm_steps[*index];
+	int32_t diff = step >> 3;
+	if(nibble & 4) diff += step;
+	if(nibble & 2) diff += step >> 1;
+	if(nibble & 1) diff += step >> 2;
+	int32_t p = *predictor + ((nibble & 8) ? -diff : diff);
+	*predictor = (int16_t)(p > INT16_MAX ? INT16_MAX
+	                       : (p < INT16_MIN ? INT16_MIN : p));
+	int32_t i = *index + adpcm_index_adjust[nibble & 7];
+	*index = (uint8_t)(i < 0 ? 0 : (i > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : i));
+}
+
+uint8_t xm_adpcm_initial_index(int32_t delta) {
+	if(delta < 0) delta = -delta;
+	/* Largest delta a single nibble can encode is 15/8 of the step */
+	uint8_t i = 0;
+	while(i < ADPCM_MAX_INDEX && adpcm_steps[i] * 15 < delta * 8) ++i;
+	return i;
+}
+
+uint8_t xm_adpcm_encode(int16_t* predictor, uint8_t* index, int16_t s) {
+	int32_t step = adpcm_steps[*index];
+	int32_t diff = s - *predictor;
+	uint8_t nibble = 0;
+	if(diff < 0) {
+		nibble = 8;
+		diff = -diff;
+	}
+	for(uint8_t bit = 4; bit; bit >>= 1, step >>= 1) {
+		if(diff >= step) {
+			nibble |= bit;
+			diff -= step;
+		}
+	}
+	xm_adpcm_step(predictor, index, nibble);
+	return nibble;
+}
+
+void xm_adpcm_decode_block(const uint8_t* block, int16_t* out) {
+	int16_t predictor = (int16_t)(block[0] | (block[1] << 8));
+	uint8_t index = block[2];
+	out[0] = predictor;
+	for(uint8_t j = 1; j < ADPCM_BLOCK_FRAMES; ++j) {
+		xm_adpcm_step(&predictor, &index,
+		              (block[4 + j / 2] >> (4 * (j % 2))) & 0xF);
+		out[j] = predictor;
+	}
+}
+#endif
+
 void xm_set_max_loop_count([[maybe_unused]] xm_context_t* context,
                            [[maybe_unused]] uint8_t loopcnt) {
 	#if XM_LOOPING_TYPE == 2
@@ -29,12 +183,42 @@ uint8_t xm_get_loop_count([[maybe_unused]] const xm_context_t* context) {
 
 
 void xm_seek(xm_context_t* ctx, uint8_t pot, uint8_t row, uint8_t tick) {
+	TRACE(ctx, XM_TRACE_SEEK, 0, pot, row, tick);
 	ctx->current_table_index = pot;
 	ctx->current_row = row;
 	ctx->current_tick = tick;
 	ctx->remaining_samples_in_tick = 0;
 }
 
+void xm_schedule_transition([[maybe_unused]] xm_context_t* ctx,
+                            [[maybe_unused]] uint8_t pot,
+                            [[maybe_unused]] uint8_t row,
+                            [[maybe_unused]] uint8_t rows,
+                            [[maybe_unused]] uint32_t crossfade_frames) {
+	#if XM_TRANSITIONS
+	ctx->transition_from = ctx->current_table_index;
+	ctx->transition_pot = pot;
+	ctx->transition_row = row;
+	ctx->transition_rows = rows;
+	ctx->transition_crossfade = crossfade_frames;
+	ctx->transition_pending = true;
+	#endif
+}
+
+void xm_cancel_transition([[maybe_unused]] xm_context_t* ctx) {
+	#if XM_TRANSITIONS
+	ctx->transition_pending = false;
+	#endif
+}
+
+bool xm_is_transition_pending([[maybe_unused]] const xm_context_t* ctx) {
+	#if XM_TRANSITIONS
+	return ctx->transition_pending;
+	#else
+	return false;
+	#endif
+}
+
 
 
 bool xm_mute_channel([[maybe_unused]] xm_context_t* ctx,
@@ -140,7 +324,11 @@ xm_sample_point_t* xm_get_sample_waveform(xm_context_t* ctx,
 	assert(sample <= ctx->module.num_samples);
 	xm_sample_t* s = ctx->samples + sample;
 	*length = s->length;
+	#if XM_ADPCM_SAMPLES
+	return nullptr;
+	#else
 	return ctx->samples_data + s->index;
+	#endif
 }
 
 
@@ -232,6 +420,53 @@ float xm_get_panning_of_channel(const xm_context_t* ctx, uint8_t chn) {
 	return y / (x + y);
 }
 
+#if XM_PROFILING
+uint64_t xm_profile_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+xm_profile_scope_t xm_profile_begin(xm_profile_t* profile, uint8_t stage) {
+	assert(stage < XM_PROFILE_STAGES);
+	profile->calls[stage]++;
+	return (xm_profile_scope_t){
+		.start = xm_profile_now(),
+		.nanoseconds = profile->nanoseconds + stage,
+	};
+}
+
+void xm_profile_end(const xm_profile_scope_t* scope) {
+	*scope->nanoseconds += xm_profile_now() - scope->start;
+}
+#endif
+
+void xm_get_profile([[maybe_unused]] const xm_context_t* restrict ctx,
+                    xm_profile_t* restrict out,
+                    uint64_t* restrict channel_frames) {
+	#if XM_PROFILING
+	*out = ctx->profile;
+	#else
+	*out = (xm_profile_t){};
+	#endif
+
+	if(channel_frames == NULL) return;
+	for(uint8_t i = 0; i < NUM_CHANNELS(&ctx->module); ++i) {
+		#if XM_PROFILING
+		channel_frames[i] = ctx->channels[i].rendered_frames;
+		#else
+		channel_frames[i] = 0;
+		#endif
+	}
+}
+
+void xm_set_render_deadline([[maybe_unused]] xm_context_t* ctx,
+                            [[maybe_unused]] uint32_t nanoseconds) {
+	#if XM_PROFILING
+	ctx->module.render_deadline = nanoseconds;
+	#endif
+}
+
 uint8_t xm_get_instrument_of_channel(const xm_context_t* ctx, uint8_t chn) {
 	assert(chn >= 1 && chn <= NUM_CHANNELS(&ctx->module));
 	const xm_channel_context_t* ch = ctx->channels + (chn - 1);
@@ -259,8 +494,8 @@ void xm_reset_context(xm_context_t* ctx) {
 	#endif
 
 	#if XM_LOOPING_TYPE == 2
-	__builtin_memset(ctx->row_loop_count, 0, MAX_ROWS_PER_PATTERN
-	                                           * ctx->module.length);
+	__builtin_memset(ctx->row_loop_count, 0,
+	                 xm_row_loop_index(ctx, ctx->module.length));
 	#endif
 
 	__builtin_memset((char*)ctx
@@ -307,6 +542,35 @@ uint16_t xm_get_sample_rate([[maybe_unused]] const xm_context_t* ctx) {
 	return CURRENT_SAMPLE_RATE(ctx);
 }
 
+void xm_set_tempo_scale([[maybe_unused]] xm_context_t* ctx,
+                        [[maybe_unused]] uint16_t scale) {
+	assert(scale >= MIN_TEMPO_SCALE);
+	#if XM_TEMPO_SCALING
+	if(scale > MAX_TEMPO_SCALE) scale = MAX_TEMPO_SCALE;
+	/* Stretch what is left of the current tick, so that the new speed
+	   applies from the next sample on */
+	ctx->remaining_samples_in_tick = (uint32_t)
+		((uint64_t)ctx->remaining_samples_in_tick
+		 * TEMPO_SCALE(&ctx->module) / scale);
+	ctx->module.tempo_scale = scale;
+	#endif
+}
+
+uint16_t xm_get_tempo_scale([[maybe_unused]] const xm_context_t* ctx) {
+	return TEMPO_SCALE(&ctx->module);
+}
+
+void xm_set_transpose([[maybe_unused]] xm_context_t* ctx,
+                      int8_t semitones, int8_t cents) {
+	assert(semitones >= -48 && semitones <= 48);
+	assert(cents >= -100 && cents <= 100);
+	#if XM_TRANSPOSE
+	ctx->module.pitch_scale = (uint32_t)
+		lrintf(exp2f((float)(semitones * 100 + cents) / 1200.f)
+		       * PITCH_SCALE_UNITY);
+	#endif
+}
+
 /* For debugging */
 void xm_print_pattern([[maybe_unused]] xm_context_t* ctx,
                       [[maybe_unused]] uint8_t pat) {
@@ -316,13 +580,22 @@ void xm_print_pattern([[maybe_unused]] xm_context_t* ctx,
 		fprintf(stderr, "---- CH %02d -----+", ch + 1);
 	}
 	fprintf(stderr, "\n");
-	for(uint8_t row = 0; row < 64; ++row) {
+	#if XM_PACKED_PATTERNS
+	xm_pattern_slot_t slot;
+	uint32_t offset = ctx->patterns[pat].data_offset;
+	#endif
+	for(uint16_t row = 0; row < ctx->patterns[pat].num_rows; ++row) {
 		fprintf(stderr, "| %02X | ", row);
 		for(uint8_t ch = 0; ch < NUM_CHANNELS(&ctx->module); ++ch) {
+			#if XM_PACKED_PATTERNS
+			offset = xm_unpack_slot(ctx, offset, &slot);
+			xm_pattern_slot_t* s = &slot;
+			#else
 			xm_pattern_slot_t* s = ctx->pattern_slots
 				+ (ctx->patterns[pat].rows_index + row)
 				  * NUM_CHANNELS(&ctx->module)
 				+ ch;
+			#endif
 
 			if(s->note == NOTE_KEY_OFF) {
 				fprintf(stderr, "OFF ");
@@ -6,6 +6,7 @@
  * License, Version 2, as published by Sam Hocevar. See
  * http://sam.zoy.org/wtfpl/COPYING for more details. */
 
+#include "xm_prefix.h"
 #include <xm.h>
 #include <math.h>
 #include <string.h>
@@ -21,12 +22,26 @@
 		fprintf(stderr, "%s(): " fmt "\n", __func__ __VA_OPT__(,) __VA_ARGS__); \
 		fflush(stderr); \
 	} while(0)
-#define TRACE(fmt, ...) NOTICE("pot %x row %x tick %x: " fmt, \
-                               ctx->current_table_index, ctx->current_row, \
-                               ctx->current_tick __VA_OPT__(,) __VA_ARGS__)
 #else
 #define NOTICE(...)
-#define TRACE(...)
+#endif
+
+#if XM_TRACE
+/* TRACE(ctx, XM_TRACE_..., channel, arg0, arg1, arg2) */
+#define TRACE(ctx, ...) do { \
+		if((ctx)->module.trace) xm_trace((ctx), __VA_ARGS__); \
+	} while(0)
+#else
+#define TRACE(...) do {} while(0)
+#endif
+
+#if XM_COMMAND_QUEUE
+#define DRAIN_COMMANDS(ctx) do { \
+		if((ctx)->module.commands) \
+			xm_drain_commands((ctx), (ctx)->module.commands); \
+	} while(0)
+#else
+#define DRAIN_COMMANDS(ctx) do {} while(0)
 #endif
 
 #define assume(x) do { if(!(x)) { __builtin_unreachable(); } } while(0)
@@ -226,6 +241,18 @@ static_assert(HAS_FEATURE(FEATURE_LINEAR_FREQUENCIES)
    seconds, or about 0.00003%. */
 #define TICK_SUBSAMPLES (1<<13)
 
+/* Tempo scale of normal speed, see xm_set_tempo_scale(). The slowest scale
+   keeps the longest possible tick (65535 Hz, 32 BPM) within
+   ctx->remaining_samples_in_tick. The fastest scale keeps the shortest tick
+   (255 BPM) at least a frame long from 1632 Hz up, xm_tick() rounds shorter
+   ticks up to a frame. */
+#define TEMPO_SCALE_UNITY 256
+#define MIN_TEMPO_SCALE 16
+#define MAX_TEMPO_SCALE 4096
+static_assert((uint64_t)UINT16_MAX * 10 * (TICK_SUBSAMPLES / 4) / MIN_BPM
+              * TEMPO_SCALE_UNITY / MIN_TEMPO_SCALE + TICK_SUBSAMPLES
+              <= UINT32_MAX);
+
 /* Granularity of ch->step and ch->sample_position, for precise pitching of
    samples. Minimum sample step is about 0.008 per frame, at 65535 Hz, when
    playing C-0. For C-1 at 48000 Hz, the step is about 0.02.
@@ -238,6 +265,36 @@ static_assert(HAS_FEATURE(FEATURE_LINEAR_FREQUENCIES)
 
 #define MAX_SAMPLE_LENGTH (UINT32_MAX/SAMPLE_MICROSTEPS)
 
+#if XM_ADPCM_SAMPLES
+/* Sample data is stored as a stream of independently decodable IMA ADPCM
+   blocks. Each block is a 4 byte header (first frame as s16le, then the step
+   index and an unused byte) followed by ADPCM_BLOCK_FRAMES-1 nibbles (low
+   nibble first). Blocks are also encoded independently, the step index is
+   seeded from the first delta of the block. Frame idx of samples_data is always frame
+   (idx % ADPCM_BLOCK_FRAMES) of block (idx / ADPCM_BLOCK_FRAMES). Every sample
+   starts on a new block, so the space taken by each sample is padded to a
+   whole number of blocks (see SAMPLE_DATA_LENGTH()). This is 4.5 bits per
+   frame, ~3.5x smaller than int16_t. */
+#define ADPCM_BLOCK_FRAMES 64
+#define ADPCM_BLOCK_SIZE (4 + ADPCM_BLOCK_FRAMES / 2)
+#define SAMPLES_DATA_SIZE(length) ((size_t)((length) + ADPCM_BLOCK_FRAMES - 1) \
+                                   / ADPCM_BLOCK_FRAMES * ADPCM_BLOCK_SIZE)
+#define SAMPLE_DATA_LENGTH(length) (((length) + ADPCM_BLOCK_FRAMES - 1) \
+                                    / ADPCM_BLOCK_FRAMES * ADPCM_BLOCK_FRAMES)
+typedef uint8_t xm_samples_data_t;
+#else
+#define SAMPLES_DATA_SIZE(length) (sizeof(xm_sample_point_t) * (length))
+#define SAMPLE_DATA_LENGTH(length) (length)
+typedef xm_sample_point_t xm_samples_data_t;
+#endif
+
+/* With XM_ADPCM_SAMPLES, ping-pong loops of XM samples are unrolled into
+   forward loops when loading, since playing an ADPCM block backwards does not
+   give the same frames as encoding the reversed data. This makes such samples
+   longer by their loop length. */
+#define UNROLL_PING_PONG (XM_ADPCM_SAMPLES \
+                          && HAS_FEATURE(FEATURE_PINGPONG_LOOPS))
+
 /* ----- Data types ----- */
 
 struct xm_envelope_point_s {
@@ -416,21 +473,78 @@ struct xm_pattern_slot_s {
 };
 typedef struct xm_pattern_slot_s xm_pattern_slot_t;
 
+#if XM_PACKED_PATTERNS
+/* Once a context is loaded, pattern slots are stored as a byte stream, in the
+   same order as unpacked slots. A slot is either:
+
+   - a byte with PACKED_SLOT_MASK set, the other bits telling which of the
+     fields below follow (fields not present are zero);
+
+   - or, if no field is zero, the slot as is (note first, with NOTE_KEY_OFF
+     stored as PACKED_NOTE_KEY_OFF).
+
+   A packed slot is never larger than a xm_pattern_slot_t, which allows
+   packing in place after loading. */
+#define PACKED_SLOT_MASK 0x80
+#define PACKED_SLOT_NOTE 0x01
+#define PACKED_SLOT_INSTRUMENT 0x02
+#define PACKED_SLOT_VOLUME_COLUMN 0x04
+#define PACKED_SLOT_EFFECT_TYPE 0x08
+#define PACKED_SLOT_EFFECT_PARAM 0x10
+#define PACKED_NOTE_KEY_OFF 0x7F
+static_assert(NOTE_SWITCH < PACKED_NOTE_KEY_OFF);
+#endif
+
 struct xm_pattern_s {
 	/* ctx->pattern_slots[index*num_chans..(index+num_rows)*num_chans] */
 	static_assert((MAX_PATTERNS - 1) * MAX_ROWS_PER_PATTERN < UINT16_MAX);
 	uint16_t rows_index;
 	uint16_t num_rows;
+
+	#if XM_PACKED_PATTERNS
+	uint32_t data_offset; /* Offset of the first row in packed slots */
+	#endif
 };
 typedef struct xm_pattern_s xm_pattern_t;
 
 struct xm_module_s {
+	#if XM_TRACE
+	xm_trace_t* trace; /* Not owned, NULL if unset */
+	#endif
+
+	#if XM_COMMAND_QUEUE
+	xm_command_queue_t* commands; /* Not owned, NULL if unset */
+	#endif
+
 	uint32_t samples_data_length;
 	uint32_t num_rows;
+
+	#if XM_PACKED_PATTERNS
+	uint32_t pattern_data_length; /* Size of packed slots, in bytes */
+	#endif
+
+	#if XM_PROFILING
+	uint32_t render_deadline; /* In nanoseconds, 0 if unset */
+	#endif
+
+	#if XM_TRANSPOSE
+	#define PITCH_SCALE_UNITY (1 << 16)
+	uint32_t pitch_scale; /* Step multiplier, PITCH_SCALE_UNITY when not
+	                         transposed */
+	#endif
+
 	uint16_t length;
 	uint16_t num_patterns;
 	uint16_t num_samples;
 
+	#if XM_TEMPO_SCALING
+	#define TEMPO_SCALE(mod) ((mod)->tempo_scale)
+	uint16_t tempo_scale; /* MIN_TEMPO_SCALE.., TEMPO_SCALE_UNITY is normal
+	                         speed */
+	#else
+	#define TEMPO_SCALE(mod) TEMPO_SCALE_UNITY
+	#endif
+
 	#if HAS_HARDCODED_CHANNEL_COUNT
 	#define NUM_CHANNELS(mod) ((uint8_t)HAS_HARDCODED_CHANNEL_COUNT)
 	#else
@@ -541,7 +655,11 @@ struct xm_module_s {
 		+ (HAS_HARDCODED_TEMPO > 0) \
 		+ (HAS_HARDCODED_BPM > 0) \
 		+ !HAS_FEATURE(FEATURE_DEFAULT_GLOBAL_VOLUME) \
-		+ !HAS_EFFECT(EFFECT_S3M_VOLUME_SLIDE))
+		+ !HAS_EFFECT(EFFECT_S3M_VOLUME_SLIDE) \
+		+ 4*XM_PACKED_PATTERNS \
+		+ 4*XM_PROFILING \
+		+ 6*XM_TEMPO_SCALING \
+		+ 4*XM_TRANSPOSE)
 	#if MODULE_PADDING % POINTER_SIZE
 	char __pad[MODULE_PADDING % POINTER_SIZE];
 	#endif
@@ -579,6 +697,14 @@ struct xm_channel_context_s {
 	float end_of_previous_sample[RAMPING_POINTS];
 	#endif
 
+	#if XM_ADPCM_SAMPLES
+	/* Block index + 1 held in adpcm_cache, or 0 if empty. Even and odd
+	   blocks are cached separately, so that linear interpolation across
+	   two blocks does not decode them again and again. */
+	uint32_t adpcm_block[2];
+	int16_t adpcm_cache[2][ADPCM_BLOCK_FRAMES];
+	#endif
+
 	uint16_t period; /* 1/64 semitone increments (linear frequencies) */
 
 	#define HAS_TONE_PORTAMENTO (HAS_EFFECT(EFFECT_TONE_PORTAMENTO) \
@@ -857,6 +983,11 @@ struct xm_channel_context_s {
 	#define CHANNEL_MUTED(ch) false
 	#endif
 
+	#if XM_PACKED_PATTERNS
+	xm_pattern_slot_t current_slot; /* Unpacked by xm_row(), ch->current
+	                                   points here */
+	#endif
+
 	#define CHANNEL_CONTEXT_PADDING (2 \
 		+ 4*!XM_TIMING_FUNCTIONS \
 		+ !HAS_EFFECT(EFFECT_MULTI_RETRIG_NOTE) \
@@ -901,16 +1032,34 @@ struct xm_channel_context_s {
 		+ !XM_MUTING_FUNCTIONS \
 		+ !HAS_PANNING \
 		+ !(HAS_PANNING && HAS_EFFECT(EFFECT_SET_CHANNEL_PANNING)) \
-		+ !HAS_FINETUNES)
+		+ !HAS_FINETUNES \
+		+ (POINTER_SIZE - 4 - (HAS_VOLUME_COLUMN != 0)) \
+		  * XM_PACKED_PATTERNS)
 	#if CHANNEL_CONTEXT_PADDING % POINTER_SIZE
 	char __pad[CHANNEL_CONTEXT_PADDING % POINTER_SIZE];
 	#endif
+
+	#if XM_PROFILING
+	uint64_t rendered_frames;
+	#endif
 };
 typedef struct xm_channel_context_s xm_channel_context_t;
 
+#if XM_SFX_VOICES
+static_assert(XM_SFX_VOICES <= UINT8_MAX);
+struct xm_sfx_voice_s {
+	xm_channel_context_t ch; /* ch.sample is NULL when the voice is free */
+	uint32_t age; /* Higher is more recent */
+	uint8_t priority;
+	char __pad[3];
+};
+typedef struct xm_sfx_voice_s xm_sfx_voice_t;
+#endif
+
 struct xm_context_s {
 	xm_pattern_t* patterns;
-	xm_pattern_slot_t* pattern_slots;
+	xm_pattern_slot_t* pattern_slots; /* Packed as bytes after loading with
+	                                     XM_PACKED_PATTERNS */
 
 	#if HAS_INSTRUMENTS
 	xm_instrument_t* instruments; /* Instrument 1 has index 0,
@@ -919,15 +1068,25 @@ struct xm_context_s {
 
 	xm_sample_t* samples;
 
+	#if !XM_ADPCM_SAMPLES
 	#define SAMPLE_DATA(ctx, idx) _Generic((xm_sample_point_t){}, \
 			int8_t: (float)(ctx)->samples_data[idx] / 128.f, \
 			int16_t: (float)(ctx)->samples_data[idx] / 32768.f, \
 			float: (ctx)->samples_data[idx])
-	xm_sample_point_t* samples_data;
+	#endif
+	xm_samples_data_t* samples_data;
 
 	xm_channel_context_t* channels;
 
+	#if XM_TRANSITIONS
+	/* Copy of the channels taken when a crossfading transition happens,
+	   they keep playing (without reading rows) while fading out */
+	xm_channel_context_t* fading_channels;
+	#endif
+
 	#if XM_LOOPING_TYPE == 2
+	/* One visit counter per row of each pattern order, the counters of
+	   order i start at xm_row_loop_index(ctx, i) */
 	uint8_t* row_loop_count;
 	#endif
 
@@ -942,6 +1101,13 @@ struct xm_context_s {
 	uint32_t generated_samples;
 	#endif
 
+	#if XM_PACKED_PATTERNS
+	/* Where xm_row() stopped unpacking, to avoid seeking from the start of
+	   the pattern on every row */
+	uint32_t next_packed_row; /* Index of the next row in pattern_slots */
+	uint32_t next_packed_offset;
+	#endif
+
 	#if XM_SAMPLE_RATE == 0
 	#define CURRENT_SAMPLE_RATE(ctx) ((ctx)->current_sample_rate)
 	uint16_t current_sample_rate; /* Output sample rate, typically 44100 or
@@ -951,9 +1117,33 @@ struct xm_context_s {
 	#endif
 
 	uint16_t current_table_index; /* 0..(module.length) */
+
+	#if XM_TRACE
+	/* Position of the latest xm_row(), for trace records */
+	uint16_t trace_table_index;
+	#endif
+
+	#if XM_LOOPING_TYPE == 2
+	/* Cached xm_row_loop_index() of row_loop_order */
+	static_assert((PATTERN_ORDER_TABLE_LENGTH - 1) * MAX_ROWS_PER_PATTERN
+	              <= UINT16_MAX);
+	uint16_t row_loop_order;
+	uint16_t row_loop_index;
+	#endif
+
+	#if XM_ADPCM_SAMPLES
+	/* ADPCM encoder state, only used while loading sample data */
+	int16_t adpcm_predictor;
+	uint8_t adpcm_index;
+	#endif
+
 	uint8_t current_tick; /* Typically 0..(ctx->tempo) */
 	uint8_t current_row;
 
+	#if XM_TRACE
+	uint8_t trace_row;
+	#endif
+
 	#if HAS_EFFECT(EFFECT_DELAY_PATTERN)
 	#define EXTRA_ROWS_DONE(ctx) ((ctx)->extra_rows_done)
 	uint8_t extra_rows_done;
@@ -1029,15 +1219,140 @@ struct xm_context_s {
 		+ 2*!HAS_EFFECT(EFFECT_DELAY_PATTERN) \
 		+ !HAS_EFFECT(EFFECT_SET_TEMPO) \
 		+ !HAS_EFFECT(EFFECT_SET_BPM) \
-		+ (XM_LOOPING_TYPE != 2) \
-		+ 2*(XM_SAMPLE_RATE != 0))
+		+ (XM_LOOPING_TYPE != 2) + 4*(XM_LOOPING_TYPE == 2) \
+		+ 2*(XM_SAMPLE_RATE != 0) \
+		+ (POINTER_SIZE-3)*XM_ADPCM_SAMPLES \
+		+ (POINTER_SIZE-3)*XM_TRACE)
 	#if CONTEXT_PADDING % POINTER_SIZE
 	char __pad[CONTEXT_PADDING % POINTER_SIZE];
 	#endif
+
+	#if XM_PROFILING
+	xm_profile_t profile;
+	#endif
+
+	#if XM_SFX_VOICES
+	xm_sfx_voice_t sfx_voices[XM_SFX_VOICES];
+	xm_pattern_slot_t sfx_slot; /* Always empty, ch->current of sound
+	                               effect voices points here */
+	char __sfx_pad[POINTER_SIZE - 4 - (HAS_VOLUME_COLUMN != 0)];
+	#endif
+
+	#if XM_TRANSITIONS
+	uint32_t transition_crossfade; /* In samples */
+	uint32_t crossfade_length; /* Of the latest transition */
+	uint32_t crossfade_remaining; /* 0 when fading_channels are unused */
+	uint16_t transition_from; /* ctx->current_table_index when the
+	                             transition was scheduled */
+	uint8_t transition_pot;
+	uint8_t transition_row;
+	uint8_t transition_rows; /* Row multiple to switch at, 0 for the next
+	                            pattern */
+	bool transition_pending;
+	char __transition_pad[POINTER_SIZE - 2];
+	#endif
+};
+
+struct xm_prescan_data_s {
+	uint32_t context_size;
+	static_assert(MAX_PATTERNS * MAX_ROWS_PER_PATTERN <= 0xFFFFFF);
+	enum:uint8_t {
+		XM_FORMAT_XMIF,
+		XM_FORMAT_XM0104,
+		XM_FORMAT_MOD,
+		XM_FORMAT_MOD_FLT8, /* FLT8 requires special logic for its
+		                       pattern data */
+		XM_FORMAT_S3M,
+	} format;
+	uint32_t num_rows:24;
+	uint32_t samples_data_length;
+	uint32_t pot_rows; /* sum of the rows of each pattern order */
+	uint16_t num_patterns;
+	uint16_t num_samples;
+	uint16_t pot_length;
+	uint8_t num_channels;
+	uint8_t num_instruments;
+};
+
+/* Header of a single producer, single consumer ring of mask + 1 items, which
+   follow it in the structure that embeds it. Indices are free running, the
+   ring is full when write - read == mask + 1. */
+struct xm_ring_s {
+	_Atomic uint32_t write; /* Only stored by the producer */
+	_Atomic uint32_t read; /* Only stored by the consumer */
+	uint32_t mask; /* Number of items - 1 */
 };
+typedef struct xm_ring_s xm_ring_t;
 
 /* ----- Internal functions ----- */
 
 uint16_t xm_rand16(uint32_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#define FNV1A_BASIS 14695981039346656037UL
+uint64_t xm_fnv1a(uint64_t, const unsigned char*, uint32_t) __attribute__((pure)) __attribute__((visibility("hidden")));
+/* Fix the internal pointers of a context that was copied with memcpy() from
+   old to ctx, and detach it from the trace and command queue of old */
+void xm_rebase_context(xm_context_t*, const xm_context_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#if XM_PACKED_PATTERNS
+uint32_t xm_unpack_slot(const xm_context_t*, uint32_t, xm_pattern_slot_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#endif
+#if XM_ADPCM_SAMPLES
+uint8_t xm_adpcm_initial_index(int32_t) __attribute__((const)) __attribute__((visibility("hidden")));
+uint8_t xm_adpcm_encode(int16_t*, uint8_t*, int16_t) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+void xm_adpcm_decode_block(const uint8_t*, int16_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#endif
+#if XM_LOOPING_TYPE == 2
+/* Number of rows of a pattern order, as counted in ctx->row_loop_count.
+   Orders of missing patterns (broken MOD/S3M files) count as 64 rows, like
+   all MOD/S3M patterns. */
+#define ORDER_NUM_ROWS(ctx, i) \
+	((ctx)->module.pattern_table[i] < (ctx)->module.num_patterns ? \
+	 (ctx)->patterns[(ctx)->module.pattern_table[i]].num_rows : 64)
+uint32_t xm_row_loop_index(const xm_context_t*, uint16_t) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#endif
 void xm_tick(xm_context_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#if XM_TRACE
+void xm_trace(xm_context_t*, uint16_t, uint8_t, uint32_t, uint32_t, uint32_t) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#endif
+/* Make an empty ring of max_items (at least 1) rounded down to a power of
+   two, so that indices can wrap around */
+void xm_ring_init(xm_ring_t*, uint32_t max_items) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+/* Producer side: get the index of a free item, or false if the ring is full,
+   then publish the item once written */
+bool xm_ring_acquire_write(xm_ring_t*, uint32_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+void xm_ring_release_write(xm_ring_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+/* Consumer side: get the number of items ready to be read and the free
+   running index of the first one, then free the items once read */
+uint32_t xm_ring_acquire_read(xm_ring_t*, uint32_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+void xm_ring_release_read(xm_ring_t*, uint32_t) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+/* Apply and remove every command in queue, from the thread playing ctx */
+void xm_drain_commands(xm_context_t*, xm_command_queue_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+#if XM_PROFILING
+struct xm_profile_scope_s {
+	uint64_t start;
+	uint64_t* nanoseconds;
+};
+typedef struct xm_profile_scope_s xm_profile_scope_t;
+uint64_t xm_profile_now(void) __attribute__((visibility("hidden")));
+xm_profile_scope_t xm_profile_begin(xm_profile_t*, uint8_t) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+void xm_profile_end(const xm_profile_scope_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+/* Time the rest of the enclosing block as one call of a XM_PROFILE_* stage */
+#define PROFILE(ctx, stage) \
+	__attribute__((cleanup(xm_profile_end))) xm_profile_scope_t \
+	profile_scope_##stage = xm_profile_begin(&(ctx)->profile, stage)
+#else
+#define PROFILE(ctx, stage)
+#endif
 void xm_print_pattern(xm_context_t*, uint8_t) __attribute((nonnull)) __attribute__((visibility("hidden")));
+
+/* Build flags suggested by xm_analyze() */
+struct xm_analysis_s {
+	uint64_t disabled_effects;
+	uint64_t disabled_features;
+	uint16_t disabled_volume_effects;
+	uint8_t panning_type;
+	char __pad[5];
+};
+typedef struct xm_analysis_s xm_analysis_t;
+void xm_analyze_module(xm_context_t*, xm_analysis_t*) __attribute__((nonnull)) __attribute__((visibility("hidden")));
+/* Variant built from the same sources, see variant.c */
+extern const xm_variant_t xm_variant __attribute__((visibility("hidden")));
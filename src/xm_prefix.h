@@ -0,0 +1,139 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Builds with XM_SYMBOL_PREFIX=xmv_foo_ rename every external symbol xm_bar
+   to xmv_foo_bar (and XM_BAR to xmv_foo_BAR), so that several variants of
+   libxm can be linked in the same program, see xm_add_variant() in
+   CMakeLists.txt. Keep this list in sync with the non-static functions and
+   variables of libxm. */
+
+#pragma once
+#ifdef XM_SYMBOL_PREFIX
+
+#define XM_PREFIXED(name) XM_PREFIXED2(XM_SYMBOL_PREFIX, name)
+#define XM_PREFIXED2(prefix, name) XM_PREFIXED3(prefix, name)
+#define XM_PREFIXED3(prefix, name) prefix##name
+
+/* Public API */
+#define xm_analyze XM_PREFIXED(analyze)
+#define xm_cache_lookup XM_PREFIXED(cache_lookup)
+#define xm_cancel_transition XM_PREFIXED(cancel_transition)
+#define xm_clone_context XM_PREFIXED(clone_context)
+#define xm_clone_size XM_PREFIXED(clone_size)
+#define xm_copy_context XM_PREFIXED(copy_context)
+#define xm_create_cache XM_PREFIXED(create_cache)
+#define xm_create_command_queue XM_PREFIXED(create_command_queue)
+#define xm_create_context XM_PREFIXED(create_context)
+#define xm_create_context_parallel XM_PREFIXED(create_context_parallel)
+#define xm_create_trace XM_PREFIXED(create_trace)
+#define xm_drain_trace XM_PREFIXED(drain_trace)
+#define xm_embedded_context XM_PREFIXED(embedded_context)
+#define xm_dump_context XM_PREFIXED(dump_context)
+#define xm_dump_size XM_PREFIXED(dump_size)
+#define xm_generate_samples XM_PREFIXED(generate_samples)
+#define xm_generate_samples_batch XM_PREFIXED(generate_samples_batch)
+#define xm_generate_samples_noninterleaved XM_PREFIXED(generate_samples_noninterleaved)
+#define xm_generate_samples_parallel XM_PREFIXED(generate_samples_parallel)
+#define xm_generate_samples_unmixed XM_PREFIXED(generate_samples_unmixed)
+#define xm_get_frequency_of_channel XM_PREFIXED(get_frequency_of_channel)
+#define xm_get_instrument_name XM_PREFIXED(get_instrument_name)
+#define xm_get_instrument_of_channel XM_PREFIXED(get_instrument_of_channel)
+#define xm_get_latest_trigger_of_channel XM_PREFIXED(get_latest_trigger_of_channel)
+#define xm_get_latest_trigger_of_instrument XM_PREFIXED(get_latest_trigger_of_instrument)
+#define xm_get_latest_trigger_of_sample XM_PREFIXED(get_latest_trigger_of_sample)
+#define xm_get_loop_count XM_PREFIXED(get_loop_count)
+#define xm_get_module_length XM_PREFIXED(get_module_length)
+#define xm_get_module_name XM_PREFIXED(get_module_name)
+#define xm_get_number_of_channels XM_PREFIXED(get_number_of_channels)
+#define xm_get_number_of_instruments XM_PREFIXED(get_number_of_instruments)
+#define xm_get_number_of_patterns XM_PREFIXED(get_number_of_patterns)
+#define xm_get_number_of_rows XM_PREFIXED(get_number_of_rows)
+#define xm_get_number_of_samples XM_PREFIXED(get_number_of_samples)
+#define xm_get_panning_of_channel XM_PREFIXED(get_panning_of_channel)
+#define xm_get_playing_speed XM_PREFIXED(get_playing_speed)
+#define xm_get_position XM_PREFIXED(get_position)
+#define xm_get_profile XM_PREFIXED(get_profile)
+#define xm_get_render_thread_commands XM_PREFIXED(get_render_thread_commands)
+#define xm_get_render_thread_position XM_PREFIXED(get_render_thread_position)
+#define xm_get_render_thread_underruns XM_PREFIXED(get_render_thread_underruns)
+#define xm_get_sample_name XM_PREFIXED(get_sample_name)
+#define xm_get_sample_rate XM_PREFIXED(get_sample_rate)
+#define xm_get_sample_waveform XM_PREFIXED(get_sample_waveform)
+#define xm_get_tempo_scale XM_PREFIXED(get_tempo_scale)
+#define xm_get_trace_drops XM_PREFIXED(get_trace_drops)
+#define xm_get_tracker_name XM_PREFIXED(get_tracker_name)
+#define xm_get_volume_of_channel XM_PREFIXED(get_volume_of_channel)
+#define xm_is_channel_active XM_PREFIXED(is_channel_active)
+#define xm_is_sfx_playing XM_PREFIXED(is_sfx_playing)
+#define xm_is_transition_pending XM_PREFIXED(is_transition_pending)
+#define xm_load_state XM_PREFIXED(load_state)
+#define xm_mute_channel XM_PREFIXED(mute_channel)
+#define xm_mute_instrument XM_PREFIXED(mute_instrument)
+#define xm_play_sfx XM_PREFIXED(play_sfx)
+#define xm_prescan_module XM_PREFIXED(prescan_module)
+#define xm_queue_max_loop_count XM_PREFIXED(queue_max_loop_count)
+#define xm_queue_mute_channel XM_PREFIXED(queue_mute_channel)
+#define xm_queue_mute_instrument XM_PREFIXED(queue_mute_instrument)
+#define xm_queue_sample_rate XM_PREFIXED(queue_sample_rate)
+#define xm_queue_seek XM_PREFIXED(queue_seek)
+#define xm_queue_tempo_scale XM_PREFIXED(queue_tempo_scale)
+#define xm_queue_transpose XM_PREFIXED(queue_transpose)
+#define xm_read_render_thread XM_PREFIXED(read_render_thread)
+#define xm_release_sfx XM_PREFIXED(release_sfx)
+#define xm_render_parallel XM_PREFIXED(render_parallel)
+#define xm_reset_context XM_PREFIXED(reset_context)
+#define xm_restore_context XM_PREFIXED(restore_context)
+#define xm_save_context XM_PREFIXED(save_context)
+#define xm_save_size XM_PREFIXED(save_size)
+#define xm_save_state XM_PREFIXED(save_state)
+#define xm_schedule_transition XM_PREFIXED(schedule_transition)
+#define xm_seek XM_PREFIXED(seek)
+#define xm_set_command_queue XM_PREFIXED(set_command_queue)
+#define xm_set_max_loop_count XM_PREFIXED(set_max_loop_count)
+#define xm_set_render_deadline XM_PREFIXED(set_render_deadline)
+#define xm_set_sample_rate XM_PREFIXED(set_sample_rate)
+#define xm_set_tempo_scale XM_PREFIXED(set_tempo_scale)
+#define xm_set_trace XM_PREFIXED(set_trace)
+#define xm_set_transpose XM_PREFIXED(set_transpose)
+#define xm_size_for_context XM_PREFIXED(size_for_context)
+#define xm_size_for_parallel_mixing XM_PREFIXED(size_for_parallel_mixing)
+#define xm_size_for_render_parallel XM_PREFIXED(size_for_render_parallel)
+#define xm_size_for_render_thread XM_PREFIXED(size_for_render_thread)
+#define xm_skip_samples XM_PREFIXED(skip_samples)
+#define xm_start_render_thread XM_PREFIXED(start_render_thread)
+#define xm_state_size XM_PREFIXED(state_size)
+#define xm_stop_render_thread XM_PREFIXED(stop_render_thread)
+#define xm_stop_sfx XM_PREFIXED(stop_sfx)
+#define XM_PRESCAN_DATA_SIZE XM_PREFIXED(PRESCAN_DATA_SIZE)
+#define XM_ANALYZE_OUTPUT_SIZE XM_PREFIXED(ANALYZE_OUTPUT_SIZE)
+
+/* Internal functions and variables */
+#define xm_adpcm_decode_block XM_PREFIXED(adpcm_decode_block)
+#define xm_adpcm_encode XM_PREFIXED(adpcm_encode)
+#define xm_adpcm_initial_index XM_PREFIXED(adpcm_initial_index)
+#define xm_analyze_module XM_PREFIXED(analyze_module)
+#define xm_drain_commands XM_PREFIXED(drain_commands)
+#define xm_fnv1a XM_PREFIXED(fnv1a)
+#define xm_print_pattern XM_PREFIXED(print_pattern)
+#define xm_profile_begin XM_PREFIXED(profile_begin)
+#define xm_profile_end XM_PREFIXED(profile_end)
+#define xm_profile_now XM_PREFIXED(profile_now)
+#define xm_rand16 XM_PREFIXED(rand16)
+#define xm_rebase_context XM_PREFIXED(rebase_context)
+#define xm_ring_acquire_read XM_PREFIXED(ring_acquire_read)
+#define xm_ring_acquire_write XM_PREFIXED(ring_acquire_write)
+#define xm_ring_init XM_PREFIXED(ring_init)
+#define xm_ring_release_read XM_PREFIXED(ring_release_read)
+#define xm_ring_release_write XM_PREFIXED(ring_release_write)
+#define xm_row_loop_index XM_PREFIXED(row_loop_index)
+#define xm_tick XM_PREFIXED(tick)
+#define xm_trace XM_PREFIXED(trace)
+#define xm_unpack_slot XM_PREFIXED(unpack_slot)
+#define xm_variant XM_PREFIXED(variant)
+
+#endif
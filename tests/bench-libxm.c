@@ -0,0 +1,271 @@
+/* Author: Romain "Artefact2" Dalmaso <artefact2@gmail.com> */
+
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include "common.h"
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define RATE 48000
+#define CHUNK_FRAMES 256
+#define MAX_SECONDS 300
+#define LOAD_REPEATS 8
+
+/* Synthetic worst cases, generated as XM 0104 modules */
+struct synth_s {
+	const char* name;
+	void (*slot)(uint8_t row, uint8_t ch, uint8_t* out);
+	uint32_t sample_frames;
+	uint8_t num_channels;
+	uint8_t num_rows;
+	uint8_t num_orders;
+	uint8_t tempo;
+	uint8_t sample_type; /* 1: forward loop, 2: ping-pong loop */
+	bool volume_envelope;
+	char __pad[6];
+};
+typedef struct synth_s synth_t;
+
+static void slot_channels(uint8_t, uint8_t, uint8_t*);
+static void slot_pingpong(uint8_t, uint8_t, uint8_t*);
+static void slot_effects(uint8_t, uint8_t, uint8_t*);
+
+static const synth_t synths[] = {
+	/* Every channel triggers a note on every row */
+	{ "channels", slot_channels, 4096, 255, 32, 8, 3, 1, false },
+	/* Notes of a long sample, bouncing on its loop points */
+	{ "pingpong", slot_pingpong, 500000, 32, 64, 16, 6, 2, false },
+	/* Many ticks per row, an effect in every slot */
+	{ "effects", slot_effects, 4096, 32, 64, 8, 15, 1, true },
+};
+
+static char* synth_module(const synth_t*, uint32_t*);
+static void bench(const char* variant, const char* name,
+                  const char* moddata, uint32_t moddata_length);
+static uint64_t now_ns(void);
+
+int main(int argc, char** argv) {
+	if(argc < 3) {
+		fprintf(stderr, "Usage: %s <variant> <file.xm | synth:name>...\n",
+		        argv[0]);
+		return 1;
+	}
+
+	for(int i = 2; i < argc; ++i) {
+		uint32_t length;
+		char* moddata = NULL;
+		if(strncmp(argv[i], "synth:", 6) == 0) {
+			for(size_t j = 0; j < sizeof(synths) / sizeof(synths[0]);
+			    ++j) {
+				if(strcmp(argv[i] + 6, synths[j].name) == 0) {
+					moddata = synth_module(synths + j, &length);
+				}
+			}
+			if(moddata == NULL) {
+				fprintf(stderr, "Unknown module %s\n", argv[i]);
+				return 1;
+			}
+		} else {
+			moddata = read_file(argv[i], &length);
+		}
+
+		const char* name = strrchr(argv[i], '/');
+		bench(argv[1], name ? name + 1 : argv[i], moddata, length);
+		free(moddata);
+	}
+	return 0;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Prints one JSON object per line */
+static void bench(const char* variant, const char* name,
+                  const char* moddata, uint32_t moddata_length) {
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module(moddata, moddata_length, p)) {
+		fprintf(stderr, "Could not load %s\n", name);
+		exit(1);
+	}
+	char* pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	/* Best of a few loads, the first one also pays for page faults */
+	xm_context_t* ctx = NULL;
+	uint64_t load_ns = UINT64_MAX;
+	for(uint8_t i = 0; i < LOAD_REPEATS; ++i) {
+		uint64_t start = now_ns();
+		if(!xm_prescan_module(moddata, moddata_length, p)) exit(1);
+		ctx = xm_create_context(pool, p, moddata, moddata_length);
+		uint64_t t = now_ns() - start;
+		if(t < load_ns) load_ns = t;
+	}
+	xm_set_sample_rate(ctx, RATE);
+
+	/* Render until the module loops, only timing xm_generate_samples() */
+	static float frames[2 * CHUNK_FRAMES];
+	uint64_t render_ns = 0, num_frames = 0, voice_frames = 0;
+	uint8_t num_channels = xm_get_number_of_channels(ctx);
+	while(!xm_get_loop_count(ctx) && num_frames < MAX_SECONDS * RATE) {
+		uint64_t start = now_ns();
+		xm_generate_samples(ctx, frames, CHUNK_FRAMES);
+		render_ns += now_ns() - start;
+		num_frames += CHUNK_FRAMES;
+
+		for(uint16_t ch = 1; ch <= num_channels; ++ch) {
+			voice_frames += xm_is_channel_active(ctx, (uint8_t)ch)
+				* CHUNK_FRAMES;
+		}
+	}
+
+	printf("{\"variant\":\"%s\",\"module\":\"%s\","
+	       "\"context_bytes\":%" PRIu32 ",\"load_ns\":%" PRIu64 ","
+	       "\"frames\":%" PRIu64 ",\"voice_frames\":%" PRIu64 ","
+	       "\"render_ns\":%" PRIu64 ",\"frames_per_second\":%.0f,"
+	       "\"ns_per_voice_frame\":%.3f}\n",
+	       variant, name, xm_dump_size(ctx), load_ns, num_frames,
+	       voice_frames, render_ns,
+	       render_ns ? (double)num_frames * 1e9 / (double)render_ns : 0.,
+	       voice_frames ? (double)render_ns / (double)voice_frames : 0.);
+	free(pool);
+}
+
+static void slot_channels(uint8_t row, uint8_t ch, uint8_t* out) {
+	out[0] = (uint8_t)(1 + (row * 7 + ch) % 96);
+	out[1] = 1;
+	out[2] = (uint8_t)(0x10 + ch % 0x41); /* set volume */
+}
+
+static void slot_pingpong(uint8_t row, uint8_t ch, uint8_t* out) {
+	if(row == 0) {
+		out[0] = (uint8_t)(25 + ch * 2);
+		out[1] = 1;
+	}
+}
+
+static void slot_effects(uint8_t row, uint8_t ch, uint8_t* out) {
+	static const uint8_t effects[][2] = {
+		{ 0x04, 0x48 }, /* vibrato */
+		{ 0x07, 0x48 }, /* tremolo */
+		{ 0x0A, 0x01 }, /* volume slide */
+		{ 0x01, 0x02 }, /* portamento up */
+		{ 0x00, 0x37 }, /* arpeggio */
+		{ 0x03, 0x10 }, /* tone portamento */
+		{ 0x1B, 0x13 }, /* multi retrig */
+		{ 0x1D, 0x21 }, /* tremor */
+	};
+	const uint8_t* e = effects[(row + ch) % 8];
+	if(row % 4 == 0 || e[0] == 0x03) {
+		out[0] = (uint8_t)(37 + (row + ch * 5) % 48);
+		out[1] = 1;
+	}
+	out[2] = 0xB4; /* vibrato (volume column) */
+	out[3] = e[0];
+	out[4] = e[1];
+}
+
+#define PUT_U8(val) do { *out++ = (char)(uint8_t)(val); } while(0)
+#define PUT_U16(val) do { PUT_U8(val); PUT_U8((val) >> 8); } while(0)
+#define PUT_U32(val) do { PUT_U16(val); PUT_U16((val) >> 16); } while(0)
+#define PUT_ZEROES(n) do { memset(out, 0, n); out += (n); } while(0)
+
+static char* synth_module(const synth_t* s, uint32_t* length) {
+	uint32_t pattern_size = 5u * s->num_rows * s->num_channels;
+	uint32_t sz = 336 + 9 + pattern_size + 263 + 40 + 2 * s->sample_frames;
+	char* moddata = malloc(sz);
+	if(moddata == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	char* out = moddata;
+
+	memcpy(out, "Extended Module: ", 17);
+	out += 17;
+	PUT_ZEROES(20);
+	PUT_U8(0x1A);
+	PUT_ZEROES(20);
+	PUT_U16(0x0104);
+	PUT_U32(276); /* header size */
+	PUT_U16(s->num_orders);
+	PUT_U16(0); /* restart position */
+	PUT_U16(s->num_channels);
+	PUT_U16(1); /* patterns */
+	PUT_U16(1); /* instruments */
+	PUT_U16(1); /* linear frequencies */
+	PUT_U16(s->tempo);
+	PUT_U16(125);
+	PUT_ZEROES(256); /* pattern order table, all pattern 0 */
+
+	PUT_U32(9);
+	PUT_U8(0);
+	PUT_U16(s->num_rows);
+	PUT_U16(pattern_size);
+	for(uint8_t row = 0; row < s->num_rows; ++row) {
+		for(uint8_t ch = 0; ch < s->num_channels; ++ch) {
+			uint8_t slot[5] = { 0 };
+			s->slot(row, ch, slot);
+			memcpy(out, slot, 5);
+			out += 5;
+		}
+	}
+
+	char* instrument = out;
+	PUT_U32(263);
+	PUT_ZEROES(22);
+	PUT_U8(0);
+	PUT_U16(1); /* samples */
+	PUT_U32(40);
+	PUT_ZEROES(96); /* sample of each note */
+	PUT_U16(0); PUT_U16(64); /* volume envelope */
+	PUT_U16(32); PUT_U16(16);
+	PUT_U16(64); PUT_U16(48);
+	PUT_ZEROES(48 - 12 + 48);
+	PUT_U8(3); /* volume envelope points */
+	PUT_U8(0);
+	PUT_U8(1); /* sustain point */
+	PUT_U8(1); /* loop start */
+	PUT_U8(2); /* loop end */
+	PUT_ZEROES(3);
+	PUT_U8(s->volume_envelope ? 0x07 : 0); /* on, sustain, loop */
+	PUT_U8(0);
+	PUT_ZEROES(4); /* autovibrato */
+	PUT_U16(0x100); /* fadeout */
+	PUT_ZEROES(22);
+	if(out - instrument != 263) abort();
+
+	PUT_U32(2 * s->sample_frames);
+	PUT_U32(0); /* loop start */
+	PUT_U32(2 * s->sample_frames);
+	PUT_U8(64);
+	PUT_U8(0);
+	PUT_U8(s->sample_type | 0x10); /* 16-bit */
+	PUT_U8(128);
+	PUT_U8(0);
+	PUT_U8(0);
+	PUT_ZEROES(22);
+
+	/* Triangle wave, delta coded */
+	int16_t prev = 0;
+	for(uint32_t i = 0; i < s->sample_frames; ++i) {
+		int32_t phase = (int32_t)(i * 1024 % 65536);
+		int16_t v = (int16_t)((phase < 32768 ? phase : 65535 - phase)
+		                      * 2 - 32768);
+		PUT_U16((uint16_t)(v - prev));
+		prev = v;
+	}
+
+	if((uint32_t)(out - moddata) != sz) abort();
+	*length = sz;
+	return moddata;
+}
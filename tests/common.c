@@ -8,7 +8,7 @@
 
 #include "common.h"
 
-xm_context_t* load_module(const char* path) {
+char* read_file(const char* path, uint32_t* length) {
 	/* Read xm file contents to a buffer */
 	FILE* xm_file = fopen(path, "rb");
 	if(xm_file == NULL) {
@@ -36,10 +36,23 @@ xm_context_t* load_module(const char* path) {
 		exit(1);
 	}
 	fclose(xm_file);
+	*length = (uint32_t)xm_file_length;
+	return xm_file_data;
+}
+
+xm_context_t* load_module(const char* path) {
+	return load_module_parallel(path, nullptr, nullptr);
+}
+
+xm_context_t* load_module_parallel(const char* path,
+                                   xm_parallel_for_t* parallel_for,
+                                   void* parallel_for_data) {
+	uint32_t xm_file_length;
+	char* xm_file_data = read_file(path, &xm_file_length);
 
 	/* Allocate xm context and free xm file data */
 	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
-	if(!xm_prescan_module(xm_file_data, (uint32_t)xm_file_length, p)) {
+	if(!xm_prescan_module(xm_file_data, xm_file_length, p)) {
 		exit(1);
 	}
 	char* ctx_buffer = malloc(xm_size_for_context(p));
@@ -47,8 +60,11 @@ xm_context_t* load_module(const char* path) {
 		perror("malloc");
 		exit(1);
 	}
-	xm_context_t* ctx = xm_create_context(ctx_buffer, p, xm_file_data,
-	                                      (uint32_t)xm_file_length);
+	xm_context_t* ctx = xm_create_context_parallel(ctx_buffer, p,
+	                                               xm_file_data,
+	                                               xm_file_length,
+	                                               parallel_for,
+	                                               parallel_for_data);
 	free(xm_file_data);
 	return ctx;
 }
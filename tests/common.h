@@ -10,5 +10,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Read the whole file in path to a malloc()'d buffer. Exit()s on error. */
+char* read_file(const char*, uint32_t*);
+
 /* Load module in path and returns a context. Exit()s on error. */
 xm_context_t* load_module(const char*);
+
+/* Same as load_module(), with xm_create_context_parallel(). */
+xm_context_t* load_module_parallel(const char*, xm_parallel_for_t*, void*);
@@ -0,0 +1,24 @@
+# Compares the "summary" output of two test-libxm builds: the generated audio
+# must be identical, and CANDIDATE must use a smaller context than REFERENCE.
+#
+# Usage: cmake -DREFERENCE=... -DCANDIDATE=... -DMODULE=... -P <this file>
+
+foreach(X REFERENCE CANDIDATE)
+	execute_process(COMMAND ${${X}} summary ${MODULE}
+		OUTPUT_VARIABLE OUT RESULT_VARIABLE RET ERROR_QUIET)
+	if(NOT RET EQUAL 0
+			OR NOT OUT MATCHES "^([0-9]+) ([0-9a-f]+)\n$")
+		message(FATAL_ERROR "${${X}} failed: ${OUT}")
+	endif()
+	set(${X}_SIZE ${CMAKE_MATCH_1})
+	set(${X}_HASH ${CMAKE_MATCH_2})
+endforeach()
+
+if(NOT CANDIDATE_HASH STREQUAL REFERENCE_HASH)
+	message(FATAL_ERROR "Generated audio mismatch")
+endif()
+if(NOT CANDIDATE_SIZE LESS REFERENCE_SIZE)
+	message(FATAL_ERROR "Context size not smaller "
+		"(${CANDIDATE_SIZE} >= ${REFERENCE_SIZE})")
+endif()
+message("Context size ${REFERENCE_SIZE} -> ${CANDIDATE_SIZE}")
@@ -8,8 +8,13 @@
 
 #include "common.h"
 #include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 static void print_position(const xm_context_t*);
+static bool frames_silent(const float*, uint32_t);
 static uint16_t modal_interpeak_distance(const float*, uint16_t, uint16_t);
 
 /* Checks generated audio samples for channel1==channel2, channel3==channel4,
@@ -27,6 +32,112 @@ static int pat0_pat1_eq(xm_context_t*);
 
 static int channelpairs_pitcheq(xm_context_t*);
 
+/* Checks that the module loops right after every row of the order table has
+   been played once. Assumes a module without jumps or pattern loops. */
+static int loop_after_all_rows(xm_context_t*);
+
+/* Prints the context size and a hash of the generated audio, to compare
+   libxm builds with different options. */
+static int summary(xm_context_t*);
+
+/* Checks that xm_restore_context() gives back the dumped context, and the
+   same sample waveforms. */
+static int dump_restore_eq(xm_context_t*, const char*);
+
+/* Checks that loading the module with xm_create_context_parallel() produces
+   the same context as xm_create_context(), with tasks run in reverse order
+   and with tasks run concurrently by a few threads. */
+static int parallel_load_eq(xm_context_t*, const char*);
+static void reverse_parallel_for(void*, uint32_t,
+                                 void (*)(void*, uint32_t), void*);
+
+/* Checks that a context cloned mid-song plays the same as the original, and
+   that playing the clone does not disturb the original. */
+static int clone_eq(xm_context_t*, const char*);
+
+/* Checks that a playback state saved mid-song resumes the same audio in
+   another context, and that it saves back to the same bytes. */
+static int state_eq(xm_context_t*, const char*);
+
+/* Checks that contexts copied out of a xm_cache_t are the same as the loaded
+   module, and that cached modules are found again, while the cache evicts and
+   moves contexts around. */
+static int cache_eq(xm_context_t*, const char*);
+
+/* Checks that commands queued in a xm_command_queue_t, also from another
+   thread, have the same effect as direct calls made before generating
+   samples. */
+static int command_queue_eq(xm_context_t*);
+
+/* Checks that frames read from a render thread are the same as frames
+   generated directly, that the reported position matches what was read, and
+   that queued seeks get there. */
+static int render_thread_eq(xm_context_t*);
+
+/* Checks that the profiling counters add up after playing the whole module:
+   stage times nest, per channel frames and voice counts stay in range, every
+   call lands in the histogram and misses an impossible deadline, and
+   xm_reset_context() clears everything but the deadline. */
+static int profile_sane(xm_context_t*);
+
+/* Checks that a trace records sensible events while playing the whole module,
+   drops records instead of blocking when full, and is not inherited by
+   clones. */
+static int trace_sane(xm_context_t*);
+
+/* Checks that sound effects are heard over a muted module, steal the lowest
+   priority then oldest voice when all voices are busy, free their voice once
+   stopped, and are copied by clones. */
+static int sfx_sane(xm_context_t*);
+
+/* Checks that scheduled transitions happen at the first row boundary asked
+   for, and that a crossfade is the sum of the old section fading out and the
+   new section fading in (each heard by muting the other one). */
+static int transition_eq(xm_context_t*);
+static void mute_all_channels(xm_context_t*, bool);
+
+/* Checks that tempo scales change how long the module plays, without changing
+   the pitch of notes, that changing the scale back and forth in the middle of
+   a tick does not move the next tick, and that ticks shorter than a frame do
+   not stall playback. */
+static int tempo_scale_eq(xm_context_t*);
+
+/* Checks that transposing by an octave halves or doubles the pitch of each
+   tick (see channelpairs_pitcheq() for the module requirements), and that
+   semitones and cents add up. */
+static int transpose_eq(xm_context_t*);
+
+/* Checks that rendering a batch of contexts, sequentially, with tasks run in
+   reverse order and with tasks run concurrently, is the same as rendering
+   each context on its own. */
+static int batch_eq(xm_context_t*, const char*);
+
+/* Checks that mixing channels in parallel tasks, sequentially, with tasks run
+   in reverse order and with tasks run concurrently, gives the same frames
+   whatever the runner, and frames close to xm_generate_samples() (the same
+   frames for modules of up to 4 channels). */
+static int parallel_mix_eq(xm_context_t*, const char*);
+
+/* Checks that skipping frames leaves the context where generating them would
+   have, and that rendering the whole module in parallel segments,
+   sequentially, with segments rendered in reverse order and concurrently,
+   gives the same frames as xm_generate_samples(), and leaves the context at
+   the same place. */
+static int render_parallel_eq(xm_context_t*, const char*);
+static void thread_parallel_for(void*, uint32_t,
+                                void (*)(void*, uint32_t), void*);
+
+/* Checks that the variant picked by xm_select_variant() is not the full build
+   (the module must be playable by one of the specialised variants), and that
+   it plays the whole module like the full build. */
+static int variants_eq(xm_context_t*, const char*);
+
+/* Checks that the context embedded by xm_add_specialized() plays like the
+   module loaded again, and is only restored once, even when first asked for
+   by several threads at once. */
+static int embedded_eq(xm_context_t*);
+static void embedded_context_task(void*, uint32_t);
+
 
 int main(int argc, char** argv) {
 	if(argc != 3) {
@@ -48,6 +159,46 @@ int main(int argc, char** argv) {
 		return channelpairs_pitcheq(ctx);
 	} else if(strcmp(argv[1], "pat0_pat1_eq") == 0) {
 		return pat0_pat1_eq(ctx);
+	} else if(strcmp(argv[1], "loop_after_all_rows") == 0) {
+		return loop_after_all_rows(ctx);
+	} else if(strcmp(argv[1], "summary") == 0) {
+		return summary(ctx);
+	} else if(strcmp(argv[1], "dump_restore_eq") == 0) {
+		return dump_restore_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "parallel_load_eq") == 0) {
+		return parallel_load_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "clone_eq") == 0) {
+		return clone_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "state_eq") == 0) {
+		return state_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "cache_eq") == 0) {
+		return cache_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "command_queue_eq") == 0) {
+		return command_queue_eq(ctx);
+	} else if(strcmp(argv[1], "render_thread_eq") == 0) {
+		return render_thread_eq(ctx);
+	} else if(strcmp(argv[1], "profile_sane") == 0) {
+		return profile_sane(ctx);
+	} else if(strcmp(argv[1], "trace_sane") == 0) {
+		return trace_sane(ctx);
+	} else if(strcmp(argv[1], "sfx_sane") == 0) {
+		return sfx_sane(ctx);
+	} else if(strcmp(argv[1], "transition_eq") == 0) {
+		return transition_eq(ctx);
+	} else if(strcmp(argv[1], "tempo_scale_eq") == 0) {
+		return tempo_scale_eq(ctx);
+	} else if(strcmp(argv[1], "transpose_eq") == 0) {
+		return transpose_eq(ctx);
+	} else if(strcmp(argv[1], "batch_eq") == 0) {
+		return batch_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "parallel_mix_eq") == 0) {
+		return parallel_mix_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "render_parallel_eq") == 0) {
+		return render_parallel_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "variants_eq") == 0) {
+		return variants_eq(ctx, argv[2]);
+	} else if(strcmp(argv[1], "embedded_eq") == 0) {
+		return embedded_eq(ctx);
 	}
 
 	fprintf(stderr, "Invalid 1st argument\n");
@@ -149,6 +300,374 @@ static int pat0_pat1_eq(xm_context_t* ctx0) {
 	return 0;
 }
 
+static int loop_after_all_rows(xm_context_t* ctx) {
+	uint32_t expected = 0;
+	for(uint16_t i = 0; i < xm_get_module_length(ctx); ++i) {
+		uint8_t pattern;
+		xm_seek(ctx, (uint8_t)i, 0, 0);
+		xm_get_position(ctx, nullptr, &pattern, nullptr, nullptr);
+		expected += xm_get_number_of_rows(ctx, pattern);
+	}
+	xm_seek(ctx, 0, 0, 0);
+
+	/* Count row changes until the loop is detected */
+	float frames[32];
+	uint32_t rows = 0;
+	uint8_t last_pot = 0, last_row = 0;
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, 16);
+		uint8_t cur_pot, cur_row;
+		xm_get_position(ctx, &cur_pot, nullptr, &cur_row, nullptr);
+		if(xm_get_loop_count(ctx)) break;
+		if(rows == 0 || cur_pot != last_pot || cur_row != last_row) {
+			rows += 1;
+			last_pot = cur_pot;
+			last_row = cur_row;
+		}
+	}
+
+	if(rows != expected) {
+		fprintf(stderr, "Looped after %u rows, expected %u\n",
+		        rows, expected);
+		print_position(ctx);
+		return 1;
+	}
+	return 0;
+}
+
+static int summary(xm_context_t* ctx) {
+	/* FNV-1a */
+	uint64_t hash = 0xCBF29CE484222325;
+	float frames[256];
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, 128);
+		const uint8_t* b = (const uint8_t*)frames;
+		for(size_t i = 0; i < sizeof(frames); ++i) {
+			hash = (hash ^ b[i]) * 0x100000001B3;
+		}
+	}
+	printf("%" PRIu32 " %016" PRIx64 "\n", xm_dump_size(ctx), hash);
+	return 0;
+}
+
+static int dump_restore_eq(xm_context_t* ctx0, const char* path) {
+	uint32_t sz = xm_dump_size(ctx0);
+	char* buf0 = malloc(sz);
+	char* buf1 = malloc(sz);
+	char* buf2 = malloc(sz);
+	if(buf0 == NULL || buf1 == NULL || buf2 == NULL) return 1;
+	xm_dump_context(ctx0, buf0);
+	memcpy(buf1, buf0, sz);
+	xm_context_t* ctx1 = xm_restore_context(buf1);
+
+	/* xm_dump_context() also decodes sample data in place, so compare with
+	   a context that was never dumped, in case delta coding is wrong both
+	   ways */
+	xm_context_t* ctx2 = load_module(path);
+	for(uint16_t i = 0; i < xm_get_number_of_samples(ctx2); ++i) {
+		uint32_t len1, len2;
+		xm_sample_point_t* w1 = xm_get_sample_waveform(ctx1, i, &len1);
+		xm_sample_point_t* w2 = xm_get_sample_waveform(ctx2, i, &len2);
+		if(len1 != len2 || (w1 != NULL && w2 != NULL
+		                    && memcmp(w1, w2, sizeof(*w1) * len1))) {
+			fprintf(stderr, "Sample %u mismatch\n", i);
+			return 1;
+		}
+	}
+
+	xm_dump_context(ctx1, buf2);
+	if(memcmp(buf0, buf2, sz)) {
+		fprintf(stderr, "Context mismatch\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int parallel_load_eq(xm_context_t* ctx0, const char* path) {
+	uint32_t sz = xm_dump_size(ctx0);
+	char* buf0 = malloc(sz);
+	char* buf1 = malloc(sz);
+	if(buf0 == NULL || buf1 == NULL) return 1;
+	xm_dump_context(ctx0, buf0);
+
+	xm_parallel_for_t* runners[] = {
+		reverse_parallel_for, thread_parallel_for,
+	};
+	for(uint8_t i = 0; i < sizeof(runners) / sizeof(runners[0]); ++i) {
+		xm_context_t* ctx1 = load_module_parallel(path, runners[i],
+		                                          nullptr);
+		xm_set_sample_rate(ctx1, 48000);
+		if(xm_dump_size(ctx1) != sz) {
+			fprintf(stderr, "Context size mismatch\n");
+			return 1;
+		}
+		xm_dump_context(ctx1, buf1);
+		if(memcmp(buf0, buf1, sz)) {
+			fprintf(stderr, "Context mismatch (runner %u)\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int clone_eq(xm_context_t* ctx0, const char* path) {
+	static float frames0[2 * 256];
+	static float frames1[2 * 256];
+	static float frames2[2 * 256];
+
+	/* Fork halfway through the song */
+	xm_context_t* ctx1 = load_module(path);
+	xm_set_sample_rate(ctx1, 48000);
+	uint32_t half = 0;
+	while(!xm_get_loop_count(ctx1)) {
+		xm_generate_samples(ctx1, frames1, 256);
+		half++;
+	}
+	half /= 2;
+
+	xm_context_t* ctx2 = load_module(path);
+	xm_set_sample_rate(ctx2, 48000);
+	for(uint32_t i = 0; i < half; ++i) {
+		xm_generate_samples(ctx0, frames0, 256);
+		xm_generate_samples(ctx2, frames2, 256);
+	}
+
+	uint16_t num_samples = xm_get_number_of_samples(ctx0);
+	uint32_t* triggers = malloc(sizeof(uint32_t) * num_samples);
+	char* pool = malloc(xm_clone_size(ctx0));
+	if(triggers == NULL || pool == NULL) return 1;
+	for(uint16_t i = 0; i < num_samples; ++i) {
+		triggers[i] = xm_get_latest_trigger_of_sample(ctx0, i);
+	}
+	xm_context_t* clone = xm_clone_context(pool, ctx0);
+
+	/* Play the whole clone first, then the original */
+	for(uint32_t i = 0; i < half; ++i) {
+		xm_generate_samples(clone, frames1, 256);
+		xm_generate_samples(ctx2, frames2, 256);
+		if(memcmp(frames1, frames2, sizeof(frames1))) {
+			fprintf(stderr, "Clone mismatch\n");
+			print_position(clone);
+			return 1;
+		}
+	}
+	for(uint16_t i = 0; i < num_samples; ++i) {
+		if(xm_get_latest_trigger_of_sample(ctx0, i) != triggers[i]) {
+			fprintf(stderr, "Clone triggered sample %u of original\n",
+			        i);
+			return 1;
+		}
+	}
+	xm_context_t* ctx3 = load_module(path);
+	xm_set_sample_rate(ctx3, 48000);
+	for(uint32_t i = 0; i < 2 * half; ++i) {
+		xm_generate_samples(ctx3, frames2, 256);
+		if(i < half) continue;
+		xm_generate_samples(ctx0, frames0, 256);
+		if(memcmp(frames0, frames2, sizeof(frames0))) {
+			fprintf(stderr, "Original mismatch after cloning\n");
+			print_position(ctx0);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int state_eq(xm_context_t* ctx0, const char* path) {
+	static float frames0[2 * 256];
+	static float frames1[2 * 256];
+
+	/* Save halfway through the song */
+	xm_context_t* ctx1 = load_module(path);
+	xm_set_sample_rate(ctx1, 48000);
+	uint32_t half = 0;
+	while(!xm_get_loop_count(ctx1)) {
+		xm_generate_samples(ctx1, frames1, 256);
+		half++;
+	}
+	half /= 2;
+	for(uint32_t i = 0; i < half; ++i) {
+		xm_generate_samples(ctx0, frames0, 256);
+	}
+
+	uint32_t sz = xm_state_size(ctx0);
+	char* buf0 = malloc(sz);
+	char* buf1 = malloc(sz);
+	if(buf0 == NULL || buf1 == NULL) return 1;
+	xm_save_state(ctx0, buf0);
+
+	ctx1 = load_module(path);
+	if(xm_load_state(ctx1, buf0, sz - 1)) {
+		fprintf(stderr, "Loaded truncated state\n");
+		return 1;
+	}
+	buf0[0x2C] = 0; /* BPM */
+	if(xm_load_state(ctx1, buf0, sz)) {
+		fprintf(stderr, "Loaded state with invalid BPM\n");
+		return 1;
+	}
+	xm_save_state(ctx0, buf0);
+	if(!xm_load_state(ctx1, buf0, sz)) {
+		fprintf(stderr, "Could not load state\n");
+		return 1;
+	}
+	xm_save_state(ctx1, buf1);
+	if(memcmp(buf0, buf1, sz)) {
+		fprintf(stderr, "State mismatch\n");
+		return 1;
+	}
+
+	for(uint32_t i = 0; i < half; ++i) {
+		xm_generate_samples(ctx0, frames0, 256);
+		xm_generate_samples(ctx1, frames1, 256);
+		if(memcmp(frames0, frames1, sizeof(frames0))) {
+			fprintf(stderr, "Audio mismatch\n");
+			print_position(ctx1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int cache_eq(xm_context_t* ctx0, const char* path) {
+	static float frames0[2 * 4096];
+	static float frames1[2 * 4096];
+	static float frames2[2 * 4096];
+	xm_context_t* ctx2 = load_module(path);
+	xm_set_sample_rate(ctx2, 48000);
+	xm_generate_samples(ctx2, frames0, 4096);
+
+	uint32_t sz = xm_dump_size(ctx0);
+	char* buf0 = malloc(sz);
+	char* buf1 = malloc(sz);
+	char* buf2 = malloc(sz);
+	if(buf0 == NULL || buf1 == NULL || buf2 == NULL) return 1;
+	xm_dump_context(ctx0, buf0);
+
+	/* The same module with 0, 1 and 2 bytes of trailing garbage, which
+	   are cached under different keys */
+	uint32_t length;
+	char* moddata = read_file(path, &length);
+	char* variants[3];
+	for(uint8_t i = 0; i < 3; ++i) {
+		variants[i] = calloc(length + i, 1);
+		if(variants[i] == NULL) return 1;
+		memcpy(variants[i], moddata, length);
+	}
+
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module(moddata, length, p)) return 1;
+	uint32_t pool_size = xm_size_for_context(p);
+
+	/* Too small to cache anything */
+	char* pool = malloc(pool_size);
+	if(pool == NULL) return 1;
+	xm_cache_t* cache = xm_create_cache(pool, pool_size / 2);
+	if(cache != NULL && xm_cache_lookup(cache, moddata, length) != NULL) {
+		fprintf(stderr, "Module should not fit in cache\n");
+		return 1;
+	}
+	free(pool);
+
+	/* Room for two contexts and their module data: the third module
+	   evicts the least recently used one, and the other one may be
+	   moved */
+	pool_size = 2 * (pool_size + length) + 4096;
+	pool = malloc(pool_size);
+	if(pool == NULL) return 1;
+	cache = xm_create_cache(pool, pool_size);
+	if(cache == NULL) return 1;
+
+	static const uint8_t lookups[] = { 0, 1, 1, 2, 1, 0, 2, 2, 1 };
+	for(uint8_t i = 0; i < sizeof(lookups); ++i) {
+		uint8_t v = lookups[i];
+		const xm_context_t* cached = xm_cache_lookup(cache, variants[v],
+		                                             length + v);
+		if(cached == NULL || xm_dump_size(cached) != sz) {
+			fprintf(stderr, "Lookup %u failed\n", i);
+			return 1;
+		}
+		if(xm_cache_lookup(cache, variants[v], length + v) != cached) {
+			fprintf(stderr, "Lookup %u missed the cache\n", i);
+			return 1;
+		}
+		xm_context_t* ctx1 = xm_copy_context(buf1, cached);
+		xm_set_sample_rate(ctx1, 48000);
+		xm_dump_context(ctx1, buf2);
+		if(memcmp(buf0, buf2, sz)) {
+			fprintf(stderr, "Context mismatch (lookup %u)\n", i);
+			return 1;
+		}
+		xm_generate_samples(ctx1, frames1, 4096);
+		if(memcmp(frames0, frames1, sizeof(frames0))) {
+			fprintf(stderr, "Audio mismatch (lookup %u)\n", i);
+			return 1;
+		}
+
+		/* A copy of a context that is playing plays the same */
+		xm_context_t* ctx3 = xm_copy_context(buf2, ctx1);
+		xm_generate_samples(ctx1, frames1, 4096);
+		xm_generate_samples(ctx3, frames2, 4096);
+		if(memcmp(frames1, frames2, sizeof(frames1))) {
+			fprintf(stderr, "Copy mismatch (lookup %u)\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Run tasks backwards, as a stand-in for a thread pool that would run them in
+   no particular order */
+static void reverse_parallel_for([[maybe_unused]] void* data,
+                                 uint32_t count,
+                                 void (*task)(void*, uint32_t),
+                                 void* task_data) {
+	while(count) {
+		task(task_data, --count);
+	}
+}
+
+struct thread_tasks_s {
+	void (*task)(void*, uint32_t);
+	void* task_data;
+	uint32_t count;
+	atomic_uint next;
+};
+
+static void* thread_tasks_worker(void* arg) {
+	struct thread_tasks_s* t = arg;
+	for(uint32_t i; (i = atomic_fetch_add(&t->next, 1)) < t->count;) {
+		t->task(t->task_data, i);
+	}
+	return nullptr;
+}
+
+/* Run tasks concurrently on a few threads, each thread picking the next task
+   not yet started */
+static void thread_parallel_for([[maybe_unused]] void* data,
+                                uint32_t count,
+                                void (*task)(void*, uint32_t),
+                                void* task_data) {
+	struct thread_tasks_s t = {
+		.task = task,
+		.task_data = task_data,
+		.count = count,
+	};
+	atomic_init(&t.next, 0);
+	pthread_t threads[4];
+	uint8_t n = 0;
+	for(; n < 4 && n < count; ++n) {
+		if(pthread_create(threads + n, nullptr, thread_tasks_worker,
+		                  &t)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	while(n) {
+		pthread_join(threads[--n], nullptr);
+	}
+}
+
 static uint16_t modal_interpeak_distance(const float* data, uint16_t count,
                                          uint16_t stride) {
 	if(count < 3) return 0;
@@ -156,12 +675,27 @@ static uint16_t modal_interpeak_distance(const float* data, uint16_t count,
 	uint16_t* counts = alloca(sizeof(uint16_t) * count);
 	__builtin_memset(counts, 0, sizeof(uint16_t) * count);
 
+	float lo = data[0], hi = data[0];
+	for(uint16_t i = 1; i < count; ++i) {
+		if(data[i*stride] < lo) lo = data[i*stride];
+		if(data[i*stride] > hi) hi = data[i*stride];
+	}
+
 	uint16_t last_peak_idx = count;
 	for(uint16_t i = 2; i < count; ++i) {
 		if(data[(i-1)*stride] < data[(i-2)*stride] ||
 		   data[(i-1)*stride] <= data[i*stride]) {
 			continue;
 		}
+		/* Only count peaks followed by the falling edge of the
+		   sawtooth, not the ripples of lossy sample storage */
+		uint16_t j = i;
+		while(j + 1 < count && data[(j+1)*stride] <= data[j*stride]) {
+			++j;
+		}
+		if(data[(i-1)*stride] - data[j*stride] < (hi - lo) / 2) {
+			continue;
+		}
 		if(last_peak_idx < count) {
 			counts[i-1 - last_peak_idx]++;
 		}
@@ -178,3 +712,907 @@ static uint16_t modal_interpeak_distance(const float* data, uint16_t count,
 
 	return last_peak_idx;
 }
+
+static int profile_sane(xm_context_t* ctx) {
+	static float frames[2 * 256];
+	uint8_t num_channels = xm_get_number_of_channels(ctx);
+	uint64_t* channel_frames = alloca(num_channels * sizeof(uint64_t));
+	uint64_t num_frames = 0;
+	uint32_t num_calls = 0;
+	xm_profile_t p;
+
+	xm_set_render_deadline(ctx, 1);
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, 256);
+		num_frames += 256;
+		num_calls++;
+	}
+	xm_get_profile(ctx, &p, channel_frames);
+
+	if(p.calls[XM_PROFILE_MIXER] != num_frames) {
+		fprintf(stderr, "mixer counted %" PRIu64 " frames, expected %"
+		        PRIu64 "\n", p.calls[XM_PROFILE_MIXER], num_frames);
+		return 1;
+	}
+	if(p.calls[XM_PROFILE_ROW] == 0
+	   || p.calls[XM_PROFILE_TICK] < p.calls[XM_PROFILE_ROW]
+	   || p.calls[XM_PROFILE_TRIGGER_NOTE] == 0
+	   || p.calls[XM_PROFILE_TICK_ENVELOPES]
+	      < p.calls[XM_PROFILE_TICK] * num_channels
+	   || p.calls[XM_PROFILE_TICK_EFFECTS]
+	      > p.calls[XM_PROFILE_TICK_ENVELOPES]) {
+		fprintf(stderr, "inconsistent call counts\n");
+		return 1;
+	}
+	if(p.nanoseconds[XM_PROFILE_ROW] > p.nanoseconds[XM_PROFILE_TICK]
+	   || p.nanoseconds[XM_PROFILE_TICK_EFFECTS]
+	      > p.nanoseconds[XM_PROFILE_TICK]
+	   || p.nanoseconds[XM_PROFILE_MIXER] == 0) {
+		fprintf(stderr, "inconsistent stage times\n");
+		return 1;
+	}
+	if(p.peak_active_voices == 0 || p.peak_active_voices > num_channels
+	   || p.active_voices > p.peak_active_voices
+	   || p.voice_ticks > p.calls[XM_PROFILE_TICK]
+	                      * p.peak_active_voices) {
+		fprintf(stderr, "inconsistent voice counts\n");
+		return 1;
+	}
+	uint32_t histogram_calls = 0;
+	for(uint8_t i = 0; i < XM_RENDER_HISTOGRAM_BUCKETS; ++i) {
+		if(p.render_histogram[i] && p.worst_render_ns < (1ull << i)) {
+			fprintf(stderr, "histogram bucket %u is above the worst "
+			        "call\n", i);
+			return 1;
+		}
+		histogram_calls += p.render_histogram[i];
+	}
+	if(histogram_calls != num_calls || p.deadline_misses != num_calls) {
+		fprintf(stderr, "%u calls, %u in histogram, %u deadline misses\n",
+		        num_calls, histogram_calls, p.deadline_misses);
+		return 1;
+	}
+	if(p.worst_pattern_index >= xm_get_module_length(ctx)) {
+		fprintf(stderr, "worst call at invalid position\n");
+		return 1;
+	}
+
+	uint64_t voice_frames = 0;
+	for(uint8_t ch = 0; ch < num_channels; ++ch) {
+		if(channel_frames[ch] > num_frames) {
+			fprintf(stderr, "channel %u rendered %" PRIu64
+			        " frames out of %" PRIu64 "\n",
+			        ch + 1, channel_frames[ch], num_frames);
+			return 1;
+		}
+		voice_frames += channel_frames[ch];
+	}
+	if(voice_frames == 0) {
+		fprintf(stderr, "no channel rendered anything\n");
+		return 1;
+	}
+
+	xm_reset_context(ctx);
+	xm_get_profile(ctx, &p, channel_frames);
+	xm_profile_t zero = {};
+	if(memcmp(&p, &zero, sizeof(p))) {
+		fprintf(stderr, "counters not cleared by xm_reset_context()\n");
+		return 1;
+	}
+	for(uint8_t ch = 0; ch < num_channels; ++ch) {
+		if(channel_frames[ch]) {
+			fprintf(stderr, "channel %u not cleared\n", ch + 1);
+			return 1;
+		}
+	}
+
+	xm_set_sample_rate(ctx, 48000);
+	xm_generate_samples(ctx, frames, 256);
+	xm_get_profile(ctx, &p, nullptr);
+	if(p.deadline_misses != 1) {
+		fprintf(stderr, "deadline not kept by xm_reset_context()\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int trace_sane(xm_context_t* ctx) {
+	static float frames[2 * 256];
+	static xm_trace_record_t records[256];
+	static _Alignas(max_align_t) char pool[16 * sizeof(xm_trace_record_t)];
+	uint8_t num_channels = xm_get_number_of_channels(ctx);
+
+	if(xm_create_trace(pool, sizeof(xm_trace_record_t)) != NULL) {
+		fprintf(stderr, "created a trace that cannot hold a record\n");
+		return 1;
+	}
+
+	/* Never drained: must drop, not block or overwrite */
+	xm_trace_t* trace = xm_create_trace(pool, sizeof(pool));
+	xm_set_trace(ctx, trace);
+	for(uint16_t i = 0; i < 1024; ++i) {
+		xm_generate_samples(ctx, frames, 256);
+	}
+	uint32_t n = xm_drain_trace(trace, records, 256);
+	if(n == 0 || n >= 16 || xm_get_trace_drops(trace) == 0
+	   || records[0].event != XM_TRACE_ROW || records[0].row != 0) {
+		fprintf(stderr, "full trace: %u records, %u drops\n", n,
+		        xm_get_trace_drops(trace));
+		return 1;
+	}
+
+	/* Drained after every call */
+	xm_reset_context(ctx);
+	xm_set_sample_rate(ctx, 48000);
+	trace = xm_create_trace(pool, sizeof(pool));
+	uint32_t counts[XM_TRACE_SEEK + 1] = {};
+	uint32_t latest_samples = 0;
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, 256);
+		n = xm_drain_trace(trace, records, 256);
+		for(uint32_t i = 0; i < n; ++i) {
+			xm_trace_record_t* r = records + i;
+			if(r->event > XM_TRACE_SEEK || r->channel > num_channels
+			   || r->samples < latest_samples) {
+				fprintf(stderr, "invalid record %u\n", i);
+				return 1;
+			}
+			if(r->event == XM_TRACE_NOTE
+			   && (r->channel == 0 || r->args[0] == 0
+			       || r->args[0] > 96)) {
+				fprintf(stderr, "invalid note record\n");
+				return 1;
+			}
+			latest_samples = r->samples;
+			counts[r->event]++;
+		}
+	}
+	if(xm_get_trace_drops(trace) || counts[XM_TRACE_ROW] == 0
+	   || counts[XM_TRACE_NOTE] == 0 || counts[XM_TRACE_JUMP] == 0
+	   || counts[XM_TRACE_LOOP] != 1 || counts[XM_TRACE_SEEK] != 0) {
+		fprintf(stderr, "unexpected event counts: %u drops, %u rows, "
+		        "%u jumps, %u loops, %u notes\n",
+		        xm_get_trace_drops(trace), counts[XM_TRACE_ROW],
+		        counts[XM_TRACE_JUMP], counts[XM_TRACE_LOOP],
+		        counts[XM_TRACE_NOTE]);
+		return 1;
+	}
+
+	xm_seek(ctx, 0, 0, 0);
+	n = xm_drain_trace(trace, records, 256);
+	if(n != 1 || records[0].event != XM_TRACE_SEEK) {
+		fprintf(stderr, "xm_seek() not traced\n");
+		return 1;
+	}
+
+	char* clone_pool = malloc(xm_clone_size(ctx));
+	xm_context_t* clone = xm_clone_context(clone_pool, ctx);
+	xm_generate_samples(clone, frames, 256);
+	if(xm_drain_trace(trace, records, 256)) {
+		fprintf(stderr, "clone wrote to the trace of its original\n");
+		return 1;
+	}
+	free(clone_pool);
+	return 0;
+}
+
+static atomic_bool command_queue_done;
+
+static void* command_queue_producer(void* queue) {
+	/* Toggle the mute of channel 1, ending unmuted */
+	for(uint16_t i = 1; i <= 1000; ++i) {
+		while(!xm_queue_mute_channel(queue, 1, i % 2)) {
+			sched_yield();
+		}
+	}
+	atomic_store(&command_queue_done, true);
+	return nullptr;
+}
+
+static int command_queue_eq(xm_context_t* ctx) {
+	static float direct[2 * 4096], queued[2 * 4096];
+	static _Alignas(max_align_t) char pool[256];
+
+	/* Fill a queue, it must refuse commands instead of overwriting */
+	xm_command_queue_t* queue = xm_create_command_queue(pool, sizeof(pool));
+	uint32_t capacity = 0;
+	while(xm_queue_max_loop_count(queue, 0)) {
+		capacity++;
+	}
+	if(capacity == 0 || capacity & (capacity - 1)) {
+		fprintf(stderr, "queue capacity %u\n", capacity);
+		return 1;
+	}
+
+	char* clone_pool = malloc(xm_clone_size(ctx));
+	xm_context_t* clone = xm_clone_context(clone_pool, ctx);
+	xm_set_command_queue(clone, queue);
+	xm_generate_samples(ctx, direct, 1000);
+	xm_generate_samples(clone, queued, 1000);
+
+	xm_seek(ctx, 1, 2, 0);
+	xm_mute_channel(ctx, 1, true);
+	xm_set_sample_rate(ctx, 44100);
+	if(!xm_queue_seek(queue, 1, 2, 0)
+	   || !xm_queue_mute_channel(queue, 1, true)
+	   || !xm_queue_sample_rate(queue, 44100)) {
+		fprintf(stderr, "queue did not drain\n");
+		return 1;
+	}
+
+	xm_generate_samples(ctx, direct, 4096);
+	xm_generate_samples(clone, queued, 4096);
+	if(memcmp(direct, queued, sizeof(direct))
+	   || xm_get_sample_rate(clone) != 44100) {
+		fprintf(stderr, "queued commands differ from direct calls\n");
+		return 1;
+	}
+
+	pthread_t producer;
+	if(pthread_create(&producer, nullptr, command_queue_producer, queue)) {
+		perror("pthread_create");
+		return 1;
+	}
+	while(!atomic_load(&command_queue_done)) {
+		xm_generate_samples(clone, queued, 64);
+	}
+	pthread_join(producer, nullptr);
+	xm_generate_samples(clone, queued, 1);
+	if(xm_mute_channel(clone, 1, false)) {
+		fprintf(stderr, "latest queued command was not applied\n");
+		return 1;
+	}
+
+	free(clone_pool);
+	return 0;
+}
+
+static int render_thread_eq(xm_context_t* ctx) {
+	/* 188 periods, read in chunks that do not line up with periods */
+	static float direct[2 * 256 * 188], threaded[2 * 256 * 188];
+	char* clone_pool = malloc(xm_clone_size(ctx));
+	xm_context_t* clone = xm_clone_context(clone_pool, ctx);
+	char* pool = malloc(xm_size_for_render_thread(4096, 256));
+	xm_render_thread_t* r = xm_start_render_thread(pool, ctx, 4096, 256);
+	if(r == NULL) {
+		fprintf(stderr, "could not start render thread\n");
+		return 1;
+	}
+
+	for(uint32_t i = 0; i < 256 * 188;) {
+		uint32_t n = 256 * 188 - i < 300 ? 256 * 188 - i : 300;
+		i += xm_read_render_thread(r, threaded + 2 * i, n);
+		sched_yield();
+	}
+	for(uint32_t i = 0; i < 256 * 188; i += 256) {
+		xm_generate_samples(clone, direct + 2 * i, 256);
+	}
+	if(memcmp(direct, threaded, sizeof(direct))) {
+		fprintf(stderr, "render thread output differs\n");
+		return 1;
+	}
+
+	uint8_t pot[2], pattern[2], row[2], loops[2];
+	uint32_t samples[2];
+	xm_get_position(clone, pot, pattern, row, samples);
+	loops[0] = xm_get_loop_count(clone);
+	xm_get_render_thread_position(r, pot + 1, pattern + 1, row + 1,
+	                              loops + 1, samples + 1);
+	if(pot[0] != pot[1] || pattern[0] != pattern[1] || row[0] != row[1]
+	   || loops[0] != loops[1] || samples[0] != samples[1]) {
+		fprintf(stderr, "render thread position %u:%u:%u, expected "
+		        "%u:%u:%u\n", pot[1], row[1], samples[1],
+		        pot[0], row[0], samples[0]);
+		return 1;
+	}
+
+	/* The seek is heard within latency + period frames */
+	uint8_t last_pot = (uint8_t)(xm_get_module_length(clone) - 1);
+	if(!xm_queue_seek(xm_get_render_thread_commands(r), last_pot, 0, 0)) {
+		fprintf(stderr, "could not queue seek\n");
+		return 1;
+	}
+	for(uint32_t i = 0; i < 8192 + 256;) {
+		xm_get_render_thread_position(r, pot, NULL, NULL, NULL, NULL);
+		if(pot[0] == last_pot) break;
+		i += xm_read_render_thread(r, threaded, 300);
+		sched_yield();
+	}
+	xm_stop_render_thread(r);
+	xm_get_position(ctx, pot + 1, NULL, NULL, NULL);
+	if(pot[0] != last_pot || pot[1] != last_pot) {
+		fprintf(stderr, "queued seek heard at %u, rendered at %u\n",
+		        pot[0], pot[1]);
+		return 1;
+	}
+
+	free(pool);
+	free(clone_pool);
+	return 0;
+}
+
+static bool frames_silent(const float* frames, uint32_t n) {
+	for(uint32_t i = 0; i < 2 * n; ++i) {
+		if(frames[i] != 0.f) return false;
+	}
+	return true;
+}
+
+static int sfx_sane(xm_context_t* ctx) {
+	static float frames[2 * 1024], frames2[2 * 1024];
+	for(uint8_t ch = 1; ch <= xm_get_number_of_channels(ctx); ++ch) {
+		xm_mute_channel(ctx, ch, true);
+	}
+	xm_generate_samples(ctx, frames, 1024);
+	if(!frames_silent(frames, 1024)) {
+		fprintf(stderr, "muted module is not silent\n");
+		return 1;
+	}
+
+	/* Fill every voice, the first play that does not get a fresh voice
+	   steals the oldest one */
+	uint8_t first = xm_play_sfx(ctx, 1, 49, 64, 128, 1);
+	if(first == 0) {
+		fprintf(stderr, "could not play sound effect\n");
+		return 1;
+	}
+	uint16_t voices = 1;
+	uint8_t v;
+	while((v = xm_play_sfx(ctx, 1, 49, 64, 128, 1)) != first) {
+		if(v != voices + 1) {
+			fprintf(stderr, "got voice %u, expected %u\n",
+			        v, voices + 1);
+			return 1;
+		}
+		voices++;
+	}
+	xm_generate_samples(ctx, frames, 1024);
+	if(frames_silent(frames, 1024)) {
+		fprintf(stderr, "sound effects are not heard\n");
+		return 1;
+	}
+
+	/* The oldest voice is now the second one, unless there is only one */
+	if(xm_play_sfx(ctx, 1, 49, 64, 128, 0) != 0) {
+		fprintf(stderr, "lower priority sound effect got a voice\n");
+		return 1;
+	}
+	v = xm_play_sfx(ctx, 1, 61, 32, 0, 2);
+	if(v != (voices > 1 ? 2 : 1)) {
+		fprintf(stderr, "stole voice %u, expected the oldest one\n", v);
+		return 1;
+	}
+	/* Skips the higher priority voice 2 */
+	if(voices > 1 && xm_play_sfx(ctx, 1, 49, 64, 128, 1)
+	   != (voices > 2 ? 3 : 1)) {
+		fprintf(stderr, "stole a higher priority voice\n");
+		return 1;
+	}
+
+	/* Clones play the same sound effects */
+	char* clone_pool = malloc(xm_clone_size(ctx));
+	xm_context_t* clone = xm_clone_context(clone_pool, ctx);
+	xm_generate_samples(ctx, frames, 1024);
+	xm_generate_samples(clone, frames2, 1024);
+	if(memcmp(frames, frames2, sizeof(frames))) {
+		fprintf(stderr, "clone sound effects differ\n");
+		return 1;
+	}
+	/* The clone has its own copy of the instruments */
+	xm_mute_instrument(ctx, 1, true);
+	xm_generate_samples(clone, frames2, 1024);
+	xm_mute_instrument(ctx, 1, false);
+	if(frames_silent(frames2, 1024)) {
+		fprintf(stderr, "clone sound effects use the original "
+		        "instruments\n");
+		return 1;
+	}
+
+	for(uint8_t i = 1; i <= voices; ++i) {
+		xm_stop_sfx(ctx, i);
+	}
+	/* One tick is at most 5 * 48000 / 64 frames, ramp down in the next */
+	for(uint8_t i = 0; i < 8; ++i) {
+		xm_generate_samples(ctx, frames, 1024);
+	}
+	for(uint8_t i = 1; i <= voices; ++i) {
+		if(xm_is_sfx_playing(ctx, i)) {
+			fprintf(stderr, "voice %u still playing after stop\n",
+			        i);
+			return 1;
+		}
+	}
+	xm_generate_samples(ctx, frames, 1024);
+	if(!frames_silent(frames, 1024)) {
+		fprintf(stderr, "stopped sound effects are still heard\n");
+		return 1;
+	}
+
+	free(clone_pool);
+	return 0;
+}
+
+static void mute_all_channels(xm_context_t* ctx, bool mute) {
+	for(uint8_t ch = 1; ch <= xm_get_number_of_channels(ctx); ++ch) {
+		xm_mute_channel(ctx, ch, mute);
+	}
+}
+
+static int transition_eq(xm_context_t* ctx) {
+	#define FADE 9600
+	#define SETTLE 1024 /* For volume ramps of muted channels to catch up */
+	uint8_t last_pot = (uint8_t)(xm_get_module_length(ctx) - 1);
+	uint8_t start_row;
+	float frame[2];
+	do {
+		xm_generate_samples(ctx, frame, 1);
+		xm_get_position(ctx, NULL, NULL, &start_row, NULL);
+	} while(start_row < 3);
+
+	char* pools[3];
+	for(uint8_t i = 0; i < 3; ++i) {
+		pools[i] = malloc(xm_clone_size(ctx));
+	}
+
+	static const uint8_t quanta[] = { 1, 4, 0 };
+	for(uint8_t i = 0; i < sizeof(quanta); ++i) {
+		xm_context_t* t = xm_clone_context(pools[0], ctx);
+		xm_context_t* ref = xm_clone_context(pools[1], ctx);
+		xm_schedule_transition(t, last_pot, 0, quanta[i], 0);
+		for(uint32_t j = 0; xm_is_transition_pending(t); ++j) {
+			if(j == 48000 * 60) {
+				fprintf(stderr, "transition never happened\n");
+				return 1;
+			}
+			xm_generate_samples(t, frame, 1);
+			xm_generate_samples(ref, frame, 1);
+		}
+
+		/* The row the transition replaced, in the reference */
+		uint8_t pot, row, played;
+		xm_get_position(t, &pot, NULL, &row, NULL);
+		xm_get_position(ref, NULL, NULL, &played, NULL);
+		bool first_boundary = quanta[i]
+			? played % quanta[i] == 0 && played > start_row
+			  && played - start_row <= quanta[i]
+			: played == 0;
+		if(pot != last_pot || row != 0 || !first_boundary) {
+			fprintf(stderr, "transition every %u rows after row %u "
+			        "went to %u:%u instead of row %u\n", quanta[i],
+			        start_row, pot, row, played);
+			return 1;
+		}
+	}
+
+	/* Same crossfade in 3 contexts, hearing both sections, only the new
+	   one, and only the old one */
+	xm_context_t* both = xm_clone_context(pools[0], ctx);
+	xm_context_t* new = xm_clone_context(pools[1], ctx);
+	xm_context_t* old = xm_clone_context(pools[2], ctx);
+	xm_schedule_transition(both, last_pot, 0, 1, FADE);
+	xm_schedule_transition(new, last_pot, 0, 1, FADE);
+	xm_schedule_transition(old, last_pot, 0, 1, FADE);
+	mute_all_channels(new, true);
+	while(xm_is_transition_pending(both)) {
+		xm_generate_samples(both, frame, 1);
+		xm_generate_samples(new, frame, 1);
+		xm_generate_samples(old, frame, 1);
+	}
+	mute_all_channels(new, false);
+	mute_all_channels(old, true);
+
+	static float both_frames[2 * FADE], new_frames[2 * FADE],
+		old_frames[2 * FADE];
+	xm_generate_samples(both, both_frames, FADE);
+	xm_generate_samples(new, new_frames, FADE);
+	xm_generate_samples(old, old_frames, FADE);
+	float old_peak = 0.f;
+	for(uint32_t i = 2 * SETTLE; i < 2 * FADE; ++i) {
+		if(__builtin_fabsf(both_frames[i] - new_frames[i] - old_frames[i])
+		   > 1e-6f) {
+			fprintf(stderr, "crossfade frame %u: %f != %f + %f\n",
+			        i / 2, (double)both_frames[i],
+			        (double)new_frames[i], (double)old_frames[i]);
+			return 1;
+		}
+		if(__builtin_fabsf(old_frames[i]) > old_peak) {
+			old_peak = __builtin_fabsf(old_frames[i]);
+		}
+	}
+	if(old_peak == 0.f) {
+		fprintf(stderr, "old section not heard during crossfade\n");
+		return 1;
+	}
+	for(uint32_t i = 2 * (FADE - 64); i < 2 * FADE; ++i) {
+		if(__builtin_fabsf(old_frames[i]) > old_peak / 16.f) {
+			fprintf(stderr, "old section not faded out\n");
+			return 1;
+		}
+	}
+	xm_generate_samples(old, old_frames, 256);
+	if(!frames_silent(old_frames, 256)) {
+		fprintf(stderr, "old section heard after crossfade\n");
+		return 1;
+	}
+
+	for(uint8_t i = 0; i < 3; ++i) {
+		free(pools[i]);
+	}
+	return 0;
+	#undef FADE
+	#undef SETTLE
+}
+
+static int tempo_scale_eq(xm_context_t* ctx) {
+	static float frames[3][2 * 4096];
+	static const uint16_t scales[] = { 256, 512, 128 };
+	uint32_t lengths[3];
+	char* pool = malloc(xm_clone_size(ctx));
+	for(uint8_t i = 0; i < 3; ++i) {
+		xm_context_t* c = xm_clone_context(pool, ctx);
+		xm_set_tempo_scale(c, scales[i]);
+		if(xm_get_tempo_scale(c) != scales[i]) {
+			fprintf(stderr, "tempo scale not set\n");
+			return 1;
+		}
+		xm_generate_samples(c, frames[i], 4096);
+		float scratch[2 * 64];
+		for(lengths[i] = 4096; !xm_get_loop_count(c); lengths[i] += 64) {
+			xm_generate_samples(c, scratch, 64);
+		}
+	}
+	if(lengths[0] / 2 < lengths[1] * 99 / 100
+	   || lengths[0] / 2 > lengths[1] * 101 / 100
+	   || lengths[0] * 2 < lengths[2] * 99 / 100
+	   || lengths[0] * 2 > lengths[2] * 101 / 100) {
+		fprintf(stderr, "module lengths %u, %u, %u frames are not "
+		        "scaled\n", lengths[0], lengths[1], lengths[2]);
+		return 1;
+	}
+
+	/* Same notes until the first tick of the faster context ends */
+	uint8_t bpm;
+	xm_get_playing_speed(ctx, &bpm, NULL);
+	uint16_t half_tick = (uint16_t)(48000 * 10 / 4 / bpm / 2 - 1);
+	if(memcmp(frames[0], frames[1], 2 * sizeof(float) * half_tick)) {
+		fprintf(stderr, "scaled tempo changed the first tick\n");
+		return 1;
+	}
+
+	xm_context_t* c = xm_clone_context(pool, ctx);
+	xm_generate_samples(c, frames[1], half_tick);
+	xm_set_tempo_scale(c, 1024);
+	xm_set_tempo_scale(c, 256);
+	xm_generate_samples(c, frames[1] + 2 * half_tick, 4096 - half_tick);
+	if(memcmp(frames[0], frames[1], sizeof(frames[0]))) {
+		fprintf(stderr, "restoring the tempo scale moved ticks\n");
+		return 1;
+	}
+
+	/* Ticks shorter than a frame must not stall playback */
+	c = xm_clone_context(pool, ctx);
+	xm_set_sample_rate(c, 100);
+	xm_set_tempo_scale(c, 8192);
+	if(xm_get_tempo_scale(c) != 4096) {
+		fprintf(stderr, "tempo scale not clamped\n");
+		return 1;
+	}
+	uint32_t fast_length = 0;
+	while(!xm_get_loop_count(c)) {
+		if(fast_length >= lengths[0]) {
+			fprintf(stderr, "fastest tempo scale stalled\n");
+			return 1;
+		}
+		xm_generate_samples(c, frames[2], 64);
+		fast_length += 64;
+	}
+
+	free(pool);
+	return 0;
+}
+
+static int transpose_eq(xm_context_t* ctx) {
+	/* Unshifted, one octave up, one octave down, 3 semitones up two
+	   ways */
+	static const int8_t transpose[][2] = {
+		{ 0, 0 }, { 12, 0 }, { -12, 0 }, { 3, 0 }, { 2, 100 },
+	};
+	#define N (sizeof(transpose) / sizeof(transpose[0]))
+	xm_context_t* c[N];
+	static float frames[N][3750 * 4];
+	for(uint8_t i = 0; i < N; ++i) {
+		c[i] = xm_clone_context(malloc(xm_clone_size(ctx)), ctx);
+		xm_set_transpose(c[i], transpose[i][0], transpose[i][1]);
+	}
+
+	uint16_t checked = 0;
+	while(!xm_get_loop_count(c[0])) {
+		for(uint8_t i = 0; i < N; ++i) {
+			xm_generate_samples_unmixed(c[i], frames[i], 3750);
+		}
+		if(memcmp(frames[3], frames[4], sizeof(frames[3]))) {
+			fprintf(stderr, "semitones and cents do not add up\n");
+			return 1;
+		}
+
+		uint16_t mipd[3];
+		for(uint8_t i = 0; i < 3; ++i) {
+			mipd[i] = modal_interpeak_distance(frames[i], 3750, 4);
+		}
+		if(mipd[0] < 16 || mipd[0] > 3750 / 8) {
+			/* Too few frames per period, or too few periods, to
+			   tell */
+			continue;
+		}
+		/* Allow some error caused by period rounding */
+		if(__builtin_abs(mipd[0] - 2 * mipd[1]) > 2
+		   || __builtin_abs(2 * mipd[0] - mipd[2]) > 2) {
+			fprintf(stderr, "MIPD %u, %u an octave up, %u an octave "
+			        "down\n", mipd[0], mipd[1], mipd[2]);
+			print_position(c[0]);
+			return 1;
+		}
+		checked++;
+	}
+	if(checked == 0) {
+		fprintf(stderr, "no tick could be checked\n");
+		return 1;
+	}
+
+	for(uint8_t i = 0; i < N; ++i) {
+		free(c[i]);
+	}
+	return 0;
+	#undef N
+}
+
+static int batch_eq(xm_context_t* ctx, const char* path) {
+	#define BATCH 6
+	static float frames[BATCH][2 * 256];
+	static float ref[2 * 256];
+
+	xm_parallel_for_t* runners[] = {
+		nullptr, reverse_parallel_for, thread_parallel_for,
+	};
+	for(uint8_t r = 0; r < sizeof(runners) / sizeof(runners[0]); ++r) {
+		/* Each context of the batch starts at a different position, and
+		   has a reference context rendered alone */
+		xm_context_t* ctxs[BATCH];
+		xm_context_t* refs[BATCH];
+		float* outputs[BATCH];
+		for(uint8_t i = 0; i < BATCH; ++i) {
+			ctxs[i] = (i == 0 && r == 0) ? ctx : load_module(path);
+			refs[i] = load_module(path);
+			xm_set_sample_rate(ctxs[i], 48000);
+			xm_set_sample_rate(refs[i], 48000);
+			for(uint8_t j = 0; j < i; ++j) {
+				xm_generate_samples(ctxs[i], frames[i], 256);
+				xm_generate_samples(refs[i], ref, 256);
+			}
+			outputs[i] = frames[i];
+		}
+
+		while(!xm_get_loop_count(ctxs[0])) {
+			xm_generate_samples_batch(ctxs, outputs, BATCH, 256,
+			                          runners[r], nullptr);
+			for(uint8_t i = 0; i < BATCH; ++i) {
+				xm_generate_samples(refs[i], ref, 256);
+				if(memcmp(frames[i], ref, sizeof(ref))) {
+					fprintf(stderr, "Frame mismatch "
+					        "(runner %u, context %u)\n",
+					        r, i);
+					print_position(refs[i]);
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static int parallel_mix_eq(xm_context_t* ctx, const char* path) {
+	/* Odd sizes, so that calls start and end anywhere in a tick */
+	static const uint16_t sizes[] = { 1, 37, 1000, 4097 };
+	static float ref[2 * 4097];
+	static float frames[3][2 * 4097];
+
+	xm_parallel_for_t* runners[] = {
+		nullptr, reverse_parallel_for, thread_parallel_for,
+	};
+	xm_context_t* ctxs[3];
+	for(uint8_t r = 0; r < 3; ++r) {
+		ctxs[r] = load_module(path);
+		xm_set_sample_rate(ctxs[r], 48000);
+	}
+	char* pool = malloc(xm_size_for_parallel_mixing(ctx, 4097));
+	if(pool == NULL) return 1;
+	bool exact = xm_get_number_of_channels(ctx) <= 4;
+
+	for(uint32_t k = 0; !xm_get_loop_count(ctx); ++k) {
+		uint16_t n = sizes[k % (sizeof(sizes) / sizeof(sizes[0]))];
+		xm_generate_samples(ctx, ref, n);
+		for(uint8_t r = 0; r < 3; ++r) {
+			xm_generate_samples_parallel(ctxs[r], frames[r], n, pool,
+			                             runners[r], nullptr);
+		}
+
+		for(uint32_t i = 0; i < 2u * n; ++i) {
+			if(frames[1][i] != frames[0][i]
+			   || frames[2][i] != frames[0][i]) {
+				fprintf(stderr, "Runner mismatch at frame %u: "
+				        "%f %f %f\n", i / 2,
+				        (double)frames[0][i],
+				        (double)frames[1][i],
+				        (double)frames[2][i]);
+				print_position(ctx);
+				return 1;
+			}
+			if(exact ? frames[0][i] != ref[i]
+			   : __builtin_fabsf(frames[0][i] - ref[i]) > 1e-5f) {
+				fprintf(stderr, "Frame mismatch at frame %u: "
+				        "%f != %f\n", i / 2,
+				        (double)frames[0][i], (double)ref[i]);
+				print_position(ctx);
+				return 1;
+			}
+		}
+	}
+	free(pool);
+	return 0;
+}
+
+static int render_parallel_eq(xm_context_t* ctx, const char* path) {
+	#define TAIL 256 /* Frames played after the parallel render */
+	#define SEGMENTS 7
+	#define SKIP 37
+
+	/* Render until the module loops, ending in the middle of a tick */
+	static float frames[2 * TAIL];
+	uint32_t length = 0;
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, frames, TAIL);
+		length += TAIL;
+	}
+	length -= TAIL / 3;
+
+	float* ref = malloc(2 * sizeof(float) * (length + 2 * TAIL));
+	float* out = malloc(2 * sizeof(float) * (length + TAIL));
+	if(ref == NULL || out == NULL) return 1;
+	xm_context_t* ctx0 = load_module(path);
+	xm_set_sample_rate(ctx0, 48000);
+	for(uint32_t i = 0; i < length + TAIL; i += TAIL) {
+		xm_generate_samples(ctx0, ref + 2 * i, TAIL);
+	}
+
+	/* Alternate skipped and generated frames, so that skips end
+	   anywhere in ticks and volume ramps */
+	xm_context_t* ctx2 = load_module(path);
+	xm_set_sample_rate(ctx2, 48000);
+	for(uint32_t i = 0; i + 2 * SKIP <= length; i += 2 * SKIP) {
+		xm_skip_samples(ctx2, SKIP);
+		xm_generate_samples(ctx2, out, SKIP);
+		if(memcmp(out, ref + 2 * (i + SKIP), 2 * sizeof(float) * SKIP)) {
+			fprintf(stderr, "Frame mismatch after skipping to "
+			        "frame %u\n", i + SKIP);
+			print_position(ctx2);
+			return 1;
+		}
+	}
+
+	xm_parallel_for_t* runners[] = {
+		nullptr, reverse_parallel_for, thread_parallel_for,
+	};
+	for(uint8_t r = 0; r < sizeof(runners) / sizeof(runners[0]); ++r) {
+		xm_context_t* ctx1 = load_module(path);
+		xm_set_sample_rate(ctx1, 48000);
+		char* pool = malloc(xm_size_for_render_parallel(ctx1, SEGMENTS));
+		if(pool == NULL) return 1;
+		xm_render_parallel(ctx1, out, length, SEGMENTS, pool,
+		                   runners[r], nullptr);
+		xm_generate_samples(ctx1, out + 2 * length, TAIL);
+
+		for(uint32_t i = 0; i < length + TAIL; ++i) {
+			if(out[2 * i] == ref[2 * i]
+			   && out[2 * i + 1] == ref[2 * i + 1]) {
+				continue;
+			}
+			fprintf(stderr, "Frame mismatch at frame %u "
+			        "(runner %u, %s)\n", i, r,
+			        (i < length) ? "render" : "after render");
+			return 1;
+		}
+		free(pool);
+	}
+	return 0;
+}
+
+static int variants_eq(xm_context_t* ctx, const char* path) {
+	static float ref[2 * 256];
+	static float frames[2 * 256];
+
+	const xm_variant_t* full = xm_get_variant(0);
+	if(full == nullptr || strcmp(full->name, "full")) {
+		fprintf(stderr, "Variant 0 is not the full build\n");
+		return 1;
+	}
+
+	uint32_t length;
+	char* moddata = read_file(path, &length);
+	xm_prescan_data_t* p = malloc(XM_PRESCAN_DATA_SIZE);
+	if(p == NULL || !xm_prescan_module(moddata, length, p)) return 1;
+	char* pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) return 1;
+	const xm_variant_t* v = xm_select_variant(pool, p, moddata, length);
+	free(pool);
+	free(p);
+	if(v == full) {
+		fprintf(stderr, "No specialised variant selected\n");
+		return 1;
+	}
+
+	/* Contexts only work with the variant that loaded them */
+	p = malloc(v->prescan_data_size);
+	if(p == NULL || !v->prescan_module(moddata, length, p)) return 1;
+	pool = malloc(v->size_for_context(p));
+	if(pool == NULL) return 1;
+	xm_context_t* vctx = v->create_context(pool, p, moddata, length);
+	v->set_sample_rate(vctx, 48000);
+
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, ref, 256);
+		v->generate_samples(vctx, frames, 256);
+		if(memcmp(frames, ref, sizeof(ref))) {
+			fprintf(stderr, "Frame mismatch in variant %s\n",
+			        v->name);
+			print_position(ctx);
+			return 1;
+		}
+	}
+	if(v->get_loop_count(vctx) != 1) {
+		fprintf(stderr, "Loop count mismatch in variant %s\n", v->name);
+		return 1;
+	}
+
+	free(vctx);
+	free(p);
+	free(moddata);
+	return 0;
+}
+
+static int embedded_eq(xm_context_t* ctx) {
+	static float ref[2 * 256];
+	static float frames[2 * 256];
+
+	xm_context_t* first[4];
+	thread_parallel_for(nullptr, 4, embedded_context_task, first);
+	xm_context_t* embedded = xm_embedded_context();
+	if(embedded == nullptr) {
+		fprintf(stderr, "No embedded context\n");
+		return 1;
+	}
+	for(uint8_t i = 0; i < 4; ++i) {
+		if(first[i] != embedded) {
+			fprintf(stderr, "Embedded context restored twice\n");
+			return 1;
+		}
+	}
+
+	while(!xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, ref, 256);
+		xm_generate_samples(embedded, frames, 256);
+		if(memcmp(frames, ref, sizeof(ref))) {
+			fprintf(stderr, "Frame mismatch\n");
+			print_position(ctx);
+			return 1;
+		}
+	}
+	if(xm_get_loop_count(embedded) != 1) {
+		fprintf(stderr, "Loop count mismatch\n");
+		return 1;
+	}
+	return 0;
+}
+
+static void embedded_context_task(void* data, uint32_t i) {
+	((xm_context_t**)data)[i] = xm_embedded_context();
+}